@@ -1,10 +1,22 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// A lookup only takes the lock of the block's hash bucket, so
+// lookups of different blocks on different cpus rarely wait for
+// each other. Misses recycle buffers in clock order.
+//
+// Buffers are allocated with kalloc(). A miss recycles a buffer
+// that has not been used for a while if there is one, and grows
+// the cache only when every buffer has been used lately, while
+// there is plenty of free memory, and never past 1/BMAXFRAC of
+// physical memory. When memory runs short, bshrink() gives pages
+// of unused buffers back. A miss with every buffer in use waits
+// for a brelse().
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -12,6 +24,13 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * bread_async and bwrite_async start the disk on a buffer and
+//     return at once, so many blocks can be in flight; bwait
+//     waits for one to finish. Do not look at the data of a
+//     bread_async buffer, or change or brelse a bwrite_async
+//     one, before bwait.
+// * bprefetch starts reading a block that will be wanted soon;
+//     the bread of it waits for the disk if it has to.
 
 
 #include "types.h"
@@ -19,37 +38,222 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
 
+#define NBUCKET 251
+#define HASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+// Buffers come from kalloc(), a page of BPP at a time.
+struct bpage {
+  struct bpage *next;
+  struct buf buf[(PGSIZE - sizeof(struct bpage*)) / sizeof(struct buf)];
+};
+#define BPP (sizeof(((struct bpage*)0)->buf) / sizeof(struct buf))
+
+// Keep this many pages free for the rest of the kernel
+// before recycling buffers rather than adding more.
+#define BKEEPFREE 512
+
+// The cache takes at most 1/BMAXFRAC of physical memory,
+// unless bsetmin() asks for more.
+#define BMAXFRAC 8
+
 struct {
+  // one miss at a time; protects pages, free, hand, nwait and min.
   struct spinlock lock;
-  struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct bpage *pages;    // all pages of buffers
+  struct buf *free;       // buffers holding no block, through prev/next
+  struct bpage *handpg;   // clock hand for eviction:
+  int hand;               //   buffer hand of page handpg
+  int nwait;              // bget()s sleeping for a buffer
+  uint min;               // never fewer buffers than this
+  uint max;               // never more buffers than this
 } bcache;
 
+// Buffers are found through a hash table. Each bucket holds
+// the buffers whose blocks hash to it, in a list through
+// prev/next, and its lock protects their refcnt and used too.
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;
+} bucket[NBUCKET];
+
+uint bhits;       // bget()s that found the block cached
+uint bmisses;     // and that did not
+uint bcontended;  // bucket lock acquires that found it taken
+uint nbuf;        // buffers in the cache
+uint bprefetches; // blocks read ahead
+
+static void
+lockbucket(struct bucket *bk)
+{
+  if(bk->lock.locked)
+    __sync_fetch_and_add(&bcontended, 1);
+  acquire(&bk->lock);
+}
+
+// put b at the front of the list *head.
+static void
+linkbuf(struct buf **head, struct buf *b)
+{
+  b->prev = 0;
+  b->next = *head;
+  if(*head)
+    (*head)->prev = b;
+  *head = b;
+}
+
+// take b off the list *head.
+static void
+unlinkbuf(struct buf **head, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    *head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+}
+
+// Add a page of buffers to the free list.
+// Returns -1 if there is no memory for it.
+// Caller must hold bcache.lock.
+static int
+bgrow(void)
+{
+  struct bpage *pg;
+  struct buf *b;
+
+  if((pg = kalloc()) == 0)
+    return -1;
+  for(b = pg->buf; b < pg->buf+BPP; b++){
+    initsleeplock(&b->lock, "buffer");
+    b->refcnt = 0;
+    b->free = 1;
+    linkbuf(&bcache.free, b);
+  }
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  nbuf += BPP;
+  return 0;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bucket; bk < bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // NBUF buffers to start with, and never fewer.
+  while(nbuf < NBUF){
+    if(bgrow() < 0)
+      panic("binit");
   }
+  bcache.min = NBUF;
+  bcache.max = (PHYSTOP - KERNBASE) / PGSIZE / BMAXFRAC * BPP;
+  bcache.handpg = bcache.pages;
+}
+
+// Keep at least n buffers in the cache from now on, for
+// users such as the log that need that many at once.
+// Returns -1 if there is no memory for them.
+int
+bsetmin(uint n)
+{
+  acquire(&bcache.lock);
+  while(nbuf < n){
+    if(bgrow() < 0){
+      release(&bcache.lock);
+      return -1;
+    }
+  }
+  if(n > bcache.min)
+    bcache.min = n;
+  if(n > bcache.max)
+    bcache.max = n;
+  release(&bcache.lock);
+  return 0;
+}
+
+// The buffer for block blockno of dev in bk, or 0.
+// Caller must hold bk->lock.
+static struct buf*
+lookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b != 0; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Move b from its bucket to the free list, unless someone is
+// using it. Returns 0 if it was moved (or already free).
+// Caller must hold bcache.lock, so that the dev and blockno
+// of every buffer, and so its bucket, stay put.
+static int
+bdrop(struct buf *b)
+{
+  struct bucket *bk;
+
+  if(b->free)
+    return 0;
+  bk = &bucket[HASH(b->dev, b->blockno)];
+  lockbucket(bk);
+  if(b->refcnt != 0 || b->disk){
+    release(&bk->lock);
+    return -1;
+  }
+  unlinkbuf(&bk->head, b);
+  release(&bk->lock);
+  b->free = 1;
+  linkbuf(&bcache.free, b);
+  return 0;
+}
+
+// Find a buffer no one is using with the clock algorithm,
+// passing over each buffer used since the hand last came by
+// once, and move it to the free list. Look at no more than
+// max buffers: with max = nbuf, fail if every buffer has been
+// used since the hand last passed; with 2*nbuf, only if every
+// buffer is in use.
+// Returns -1 if no buffer was found.
+// Caller must hold bcache.lock.
+static int
+victim(int max)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  for(int n = 0; n < max; n++){
+    b = &bcache.handpg->buf[bcache.hand];
+    if(++bcache.hand == BPP){
+      bcache.hand = 0;
+      if((bcache.handpg = bcache.handpg->next) == 0)
+        bcache.handpg = bcache.pages;
+    }
+    if(b->free)
+      return 0;
+    bk = &bucket[HASH(b->dev, b->blockno)];
+    lockbucket(bk);
+    if(b->refcnt == 0 && b->used){
+      b->used = 0;
+      release(&bk->lock);
+      continue;
+    }
+    release(&bk->lock);
+    if(bdrop(b) == 0)
+      return 0;
+  }
+  return -1;
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,95 +263,230 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
-
-  acquire(&bcache.lock);
+  struct bucket *bk = &bucket[HASH(dev, blockno)];
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
+  lockbucket(bk);
+  if((b = lookup(bk, dev, blockno)) != 0)
+    goto found;
+  release(&bk->lock);
+
+  // Not cached. Look again once no one else can be loading
+  // a block, in case someone just loaded this one.
+  // Count this miss as waiting before looking at any refcnt
+  // or disk flag; see bwakeup().
+  acquire(&bcache.lock);
+  bcache.nwait++;
+  __sync_synchronize();
+  for(;;){
+    lockbucket(bk);
+    if((b = lookup(bk, dev, blockno)) != 0){
+      bcache.nwait--;
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      goto found;
     }
+    release(&bk->lock);
+
+    // Take a free buffer, or recycle one not used lately. If
+    // all have been, add more while the cache is under its cap
+    // and memory is plentiful, or else recycle the one the hand
+    // reaches first. If all are in use, add more with whatever
+    // memory there is, up to the cap, or wait.
+    if(bcache.free != 0 || victim(nbuf) == 0 ||
+       (nbuf < bcache.max && kfreepages() > BKEEPFREE && bgrow() == 0) ||
+       victim(2*nbuf) == 0 || (nbuf < bcache.max && bgrow() == 0))
+      break;
+    sleep(&bcache, &bcache.lock);
   }
+  bcache.nwait--;
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  b = bcache.free;
+  unlinkbuf(&bcache.free, b);
+  b->free = 0;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  b->used = 1;
+  lockbucket(bk);
+  linkbuf(&bk->head, b);
+  release(&bk->lock);
+  release(&bcache.lock);
+  __sync_fetch_and_add(&bmisses, 1);
+  acquiresleep(&b->lock);
+  return b;
+
+ found:
+  b->refcnt++;
+  b->used = 1;
+  release(&bk->lock);
+  __sync_fetch_and_add(&bhits, 1);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Give a page of buffers back to kalloc(), if the cache has
+// more than bcache.min buffers and a page none of which are in use.
+// Called when memory runs short (see kallocswap()).
+// Returns 0, or -1 if no page could be freed.
+int
+bshrink(void)
+{
+  struct bpage *pg, **pp;
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(pp = &bcache.pages; (pg = *pp) != 0 && nbuf - BPP >= bcache.min; pp = &pg->next){
+    for(b = pg->buf; b < pg->buf+BPP; b++){
+      if(bdrop(b) < 0)
+        break;
+    }
+    if(b < pg->buf+BPP)
+      continue;
+
+    for(b = pg->buf; b < pg->buf+BPP; b++)
+      unlinkbuf(&bcache.free, b);
+    *pp = pg->next;
+    nbuf -= BPP;
+    if(bcache.handpg == pg){
+      bcache.hand = 0;
+      if((bcache.handpg = pg->next) == 0)
+        bcache.handpg = bcache.pages;
     }
+    release(&bcache.lock);
+    kfree(pg);
+    return 0;
   }
-  panic("bget: no buffers");
+  release(&bcache.lock);
+  return -1;
 }
 
-// Return a locked buf with the contents of the indicated block.
+// Return a locked buf for the indicated block, having started
+// to read its contents if they are not cached. Call bwait()
+// before using them.
 struct buf*
-bread(uint dev, uint blockno)
+bread_async(uint dev, uint blockno)
 {
   struct buf *b;
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    // valid from here on: anyone who looks waits for the disk.
+    virtio_disk_start(b, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf with the contents of the indicated block.
+struct buf*
+bread(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bread_async(dev, blockno);
+  bwait(b);
+  return b;
+}
+
+// Start reading the indicated block into the cache, if it is
+// not there already, and return without waiting for the disk.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk = &bucket[HASH(dev, blockno)];
+
+  lockbucket(bk);
+  b = lookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return;
+
+  // no one can write b until they have read it, which waits.
+  b = bread_async(dev, blockno);
+  brelse(b);
+  __sync_fetch_and_add(&bprefetches, 1);
+}
+
+// Start writing b's contents to disk.  Must be locked,
+// and must stay locked and unchanged until bwait(b).
+void
+bwrite_async(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_async");
+  bwait(b);
+  virtio_disk_start(b, 1);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
-  if(!holdingsleep(&b->lock))
-    panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bwrite_async(b);
+  bwait(b);
+}
+
+// Wait for the disk to finish reading or writing b.
+void
+bwait(struct buf *b)
+{
+  if(b->disk)
+    virtio_disk_wait(b);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // b's refcnt keeps it in its bucket.
+  bk = &bucket[HASH(b->dev, b->blockno)];
+  lockbucket(bk);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  release(&bk->lock);
+  bwakeup();
+}
+
+// A buffer may have become free to recycle: its refcnt has
+// dropped, or the disk is done with it. Wake any bget() that
+// is waiting for one. bget() counts itself in nwait before it
+// looks at refcnts and disk flags, and holds bcache.lock until
+// it sleeps; we look at nwait after changing them, so either
+// it sees the change or we see it and wait for it to sleep.
+void
+bwakeup(void)
+{
+  __sync_synchronize();
+  if(bcache.nwait){
+    acquire(&bcache.lock);
+    wakeup(&bcache);
+    release(&bcache.lock);
   }
-  
-  release(&bcache.lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bucket[HASH(b->dev, b->blockno)];
+
+  lockbucket(bk);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bucket[HASH(b->dev, b->blockno)];
+
+  lockbucket(bk);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
+  bwakeup();
 }
-
-
@@ -1,11 +1,13 @@
 struct buf {
-  int valid;   // has data been read from disk?
+  int valid;   // has data been read from disk? (or is it being?)
   int disk;    // does disk "own" buf?
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  int used;    // used since the clock hand last passed?
+  int free;    // holds no block; on the free list, not in a bucket
+  struct buf *prev; // hash bucket list, or free list
   struct buf *next;
   uchar data[BSIZE];
 };
@@ -107,10 +107,13 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
 
-    // copy the input byte to the user-space buffer.
+    // copy the input byte to the user-space buffer, without
+    // cons.lock: either_copyout() may sleep to fault the page in.
     cbuf = c;
+    release(&cons.lock);
     if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
+      return target - n;
+    acquire(&cons.lock);
 
     dst++;
     --n;
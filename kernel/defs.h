@@ -4,18 +4,27 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct shmseg;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct tgroup;
 struct superblock;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bread_async(uint, uint);
 void            brelse(struct buf*);
+void            bwakeup(void);
 void            bwrite(struct buf*);
+void            bwrite_async(struct buf*);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
+void            bprefetch(uint, uint);
+int             bsetmin(uint);
 void            bunpin(struct buf*);
+int             bshrink(void);
 
 // console.c
 void            consoleinit(void);
@@ -23,7 +32,7 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
-int             exec(char*, char**);
+int             exec(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -53,6 +62,12 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+struct inode*   itruncopen(struct inode*);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -63,12 +78,26 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kdup(void *);
+void*           kallocmega(void);
+int             krefcnt(void *);
+int             kfreepages(void);
+
+// ksm.c
+void            ksminit(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_opmax(void);
+void            log_sync(void);
+
+// membench.c
+void            membench(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -85,7 +114,9 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             spawn(char*, char**, int*);
+int             clone(uint64, uint64, uint64);
+uint64          growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -94,11 +125,16 @@ struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
 void            procinit(void);
+int             asidcheck(struct proc*);
+uint64          usersatp(struct proc*);
+uint64          kernelsatp(struct proc*);
+void            uvmsync(struct proc*);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
+int             join(int, uint64);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
@@ -107,6 +143,24 @@ void            procdump(void);
 int             pause_system(int seconds);
 int             kill_system(void);
 int             print_stats(void);
+void            kthread(char*, void (*)(void));
+int             uvmquiet(struct proc*);
+
+// shm.c
+void            shminit(void);
+int             shmget(int, int);
+uint64          shmattach(int);
+int             shmdetach(uint64);
+int             shmfork(struct proc*, struct proc*);
+void            shmdetachall(struct proc*);
+void            shmexit(struct tgroup*);
+
+// swap.c
+void            swapinit(int, struct superblock*);
+int             swapout(void);
+int             swapin(pagetable_t, uint64);
+void            swapfree(pte_t);
+void*           kallocswap(void);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -156,11 +210,20 @@ void            uartputc(int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
+// uaccess.S
+int             copyuser(void*, void*, uint64);
+int             copyuserstr(char*, char*, uint64);
+
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+pagetable_t     kvmcreate(void);
+void            kvmsync(pagetable_t, pagetable_t);
+void            kvmfree(pagetable_t);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walklevel(pagetable_t, uint64, int*, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
@@ -169,6 +232,9 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, int);
+uint64          uvmaddr(pagetable_t, uint64, int);
+int             uvmprivate(pagetable_t, uint64, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -183,6 +249,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -9,8 +9,12 @@
 
 static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
 
+// Replace p's user memory with the program in path, passing
+// it argv. p is the current process, or a new one that
+// spawn() is setting up. path is looked up relative to the
+// current process's directory.
 int
-exec(char *path, char **argv)
+exec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -19,7 +23,10 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+
+  // other threads still use the old page table.
+  if(p->tg->ref > 1)
+    return -1;
 
   begin_op();
 
@@ -61,7 +68,6 @@ exec(char *path, char **argv)
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -109,8 +115,10 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  shmdetachall(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  uvmsync(p);
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
@@ -139,7 +147,7 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
   uint64 pa;
 
   for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
+    pa = uvmaddr(pagetable, va + i, 1);
     if(pa == 0)
       panic("loadseg: address should exist");
     if(sz - i < PGSIZE)
@@ -146,25 +146,29 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
+    // write as many blocks at a time as one op may log,
+    // to avoid exceeding the maximum log transaction size,
+    // including i-node, indirect blocks (a chain of NLEVEL
+    // at most, for writes of fewer than NINDIRECT blocks),
+    // allocation blocks, and 2 blocks of slop for non-aligned
+    // writes. this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = ((log_opmax()-1-NLEVEL-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      int nlog = 2*((n1 + BSIZE-1) / BSIZE) + 1+NLEVEL+2;
+      if(nlog < MAXOPBLOCKS)
+        nlog = MAXOPBLOCKS;
 
-      begin_op();
+      begin_opn(nlog);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nlog);
 
       if(r != n1){
         // error from writei
@@ -26,7 +26,10 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+NLEVEL];
+
+  uint raoff;         // where a sequential read would go next
+  uint rablock;       // blocks before this were read ahead
 };
 
 // map major device number to device functions.
@@ -44,6 +44,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swapinit(dev, &sb);
 }
 
 // Zero a block.
@@ -191,7 +192,8 @@ static struct inode* iget(uint dev, uint inum);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if there is no free inode.
 struct inode*
 ialloc(uint dev, short type)
 {
@@ -211,7 +213,8 @@ ialloc(uint dev, short type)
     }
     brelse(bp);
   }
-  panic("ialloc: no inodes");
+  printf("ialloc: no inodes\n");
+  return 0;
 }
 
 // Copy a modified in-memory inode to disk.
@@ -267,6 +270,8 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->raoff = 0;
+  ip->rablock = 0;
   release(&itable.lock);
 
   return ip;
@@ -370,15 +375,20 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT after
+// those are found through the double-indirect block
+// ip->addrs[NDIRECT+1], which lists NINDIRECT indirect blocks,
+// and the NTINDIRECT after those through the triple-indirect
+// block ip->addrs[NDIRECT+2], one level deeper again.
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, span;
   struct buf *bp;
+  int level;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
@@ -387,53 +397,157 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  // find the tree that holds bn, and how many blocks
+  // each entry of its top block covers.
+  span = 1;
+  for(level = 1; level <= NLEVEL; level++){
+    if(bn < span*NINDIRECT)
+      break;
+    bn -= span*NINDIRECT;
+    span *= NINDIRECT;
+  }
+  if(level > NLEVEL)
+    panic("bmap: out of range");
+
+  // walk down it, allocating indirect blocks as necessary.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0)
+    ip->addrs[NDIRECT+level-1] = addr = balloc(ip->dev);
+  for(; level > 0; level--, span /= NINDIRECT){
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn / span]) == 0){
+      a[bn / span] = addr = balloc(ip->dev);
       log_write(bp);
     }
     brelse(bp);
-    return addr;
+    bn %= span;
   }
+  return addr;
+}
+
+// Freeing a big file's blocks logs one bitmap block for each
+// BPB blocks, and more than one transaction can hold. So they
+// are freed a step at a time, each logging at most TRUNCBLOCKS
+// bitmap and indirect blocks, leaving room in the caller's
+// MAXOPBLOCKS for its own blocks and the inode.
+#define TRUNCBLOCKS (MAXOPBLOCKS/2)
+
+struct trunc {
+  int n;
+  uint blocks[TRUNCBLOCKS];  // logged by this step
+};
+
+// May this step log block b? Counts b if it is new.
+static int
+charge(struct trunc *t, uint b)
+{
+  int i;
 
-  panic("bmap: out of range");
+  for(i = 0; i < t->n; i++)
+    if(t->blocks[i] == b)
+      return 1;
+  if(t->n == TRUNCBLOCKS)
+    return 0;
+  t->blocks[t->n++] = b;
+  return 1;
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Free block *ap and, if it is an indirect block level levels
+// above the data, the blocks it lists, and clear *ap. Return 0
+// if the step ran out of room first; the entries of the blocks
+// freed so far are cleared, so the tree is still whole.
+static int
+bfreetree(struct trunc *t, int dev, uint *ap, int level)
 {
-  int i, j;
   struct buf *bp;
   uint *a;
+  int j, ok = 1, dirty = 0;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  if(level > 0){
+    bp = bread(dev, *ap);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    for(j = 0; j < NINDIRECT && ok; j++){
+      if(a[j] == 0)
+        continue;
+      if((ok = charge(t, bp->blockno) && bfreetree(t, dev, &a[j], level-1)))
+        dirty = 1;
     }
+    if(dirty)
+      log_write(bp);
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    if(!ok)
+      return 0;
   }
+  if(!charge(t, BBLOCK(*ap, sb)))
+    return 0;
+  bfree(dev, *ap);
+  *ap = 0;
+  return 1;
+}
 
+// Free as many of ip's blocks as one step may.
+// Return 1 if there are none left.
+static int
+itruncstep(struct inode *ip)
+{
+  struct trunc t;
+  int i;
+
+  t.n = 0;
+  for(i = 0; i < NDIRECT; i++){
+    if(ip->addrs[i] && !bfreetree(&t, ip->dev, &ip->addrs[i], 0))
+      return 0;
+  }
+  for(i = 0; i < NLEVEL; i++){
+    if(ip->addrs[NDIRECT+i] &&
+       !bfreetree(&t, ip->dev, &ip->addrs[NDIRECT+i], i+1))
+      return 0;
+  }
+  return 1;
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock, and be inside a begin_op()
+// transaction, which itrunc() may commit and begin again
+// between steps. So no other op may be waiting to lock ip;
+// iput() calls it only for the last reference.
+void
+itrunc(struct inode *ip)
+{
+  while(!itruncstep(ip)){
+    iupdate(ip);  // the blocks freed so far
+    end_op();
+    begin_op();
+  }
+  ip->size = 0;
+  ip->rablock = 0;
+  iupdate(ip);
+}
+
+// Truncate inode ip, which others may be waiting to lock, for
+// open(O_TRUNC). Blocks that do not fit in the caller's
+// transaction are handed to a new unlinked inode, which is
+// returned for the caller to iput() once it has unlocked ip.
+// If there is no free inode, they stay with ip, past its new
+// size: writes use them again, and the last iput() frees them.
+// Caller must hold ip->lock.
+struct inode*
+itruncopen(struct inode *ip)
+{
+  struct inode *rest = 0;
+
+  if(!itruncstep(ip) && (rest = ialloc(ip->dev, T_FILE)) != 0){
+    ilock(rest);
+    memmove(rest->addrs, ip->addrs, sizeof(ip->addrs));
+    rest->size = ip->size;
+    iupdate(rest);
+    iunlock(rest);
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+  }
   ip->size = 0;
+  ip->rablock = 0;
   iupdate(ip);
+  return rest;
 }
 
 // Copy stat information from inode.
@@ -448,6 +562,31 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// If a read of n bytes at off carries on where the last read
+// of ip left off, start reading the next NREADAHEAD blocks of
+// the file, so a sequential reader finds them in the cache.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, last = ip->raoff / BSIZE;
+
+  bn = off / BSIZE;
+  ip->raoff = off + n;
+  if(bn < last || bn > last + 1){
+    ip->rablock = 0;
+    return;
+  }
+
+  bn = (off + n + BSIZE - 1) / BSIZE;
+  end = min(bn + NREADAHEAD, (ip->size + BSIZE - 1) / BSIZE);
+  if(bn < ip->rablock)
+    bn = ip->rablock;
+  for(; bn < end; bn++)
+    bprefetch(ip->dev, bmap(ip, bn));
+  ip->rablock = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -462,6 +601,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -632,8 +772,12 @@ namex(char *path, int nameiparent, char *name)
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    // another thread may be changing it.
+    acquire(&myproc()->tg->lock);
+    ip = idup(myproc()->tg->cwd);
+    release(&myproc()->tg->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
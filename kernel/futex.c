@@ -0,0 +1,117 @@
+// Futexes: blocking on a user address.
+//
+// futexwait(addr, val) puts the calling thread to sleep if the
+// int at addr still holds val; futexwake(addr, n) wakes up to n
+// threads waiting on addr. User code keeps its lock state in the
+// int and only calls in when it has to wait or someone waits (see
+// user/thread.c).
+//
+// A futex is named by (page table, user address), so the threads
+// of one process can share one, but not separate processes.
+//
+// Each waiter links a struct fwait on its kernel stack into a
+// hash bucket and sleeps on it, so that futexwake() wakes just
+// the ones it picks, in the order they started waiting.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 64  // hash buckets
+
+struct fwait {
+  pagetable_t pagetable;
+  uint64 addr;
+  int woken;
+  struct fwait *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct fwait *bucket[NFUTEX];
+} futex;
+
+void
+futexinit(void)
+{
+  initlock(&futex.lock, "futex");
+}
+
+static struct fwait**
+bucket(pagetable_t pagetable, uint64 addr)
+{
+  return &futex.bucket[((uint64)pagetable / PGSIZE ^ addr / 4) % NFUTEX];
+}
+
+// Sleep until woken by futexwake(), if the int at addr in the
+// current process is val. Returns 0 once woken, or -1 if the
+// int is not val, addr is bad, or the thread was killed.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct fwait w, **wp;
+  int cur;
+
+  if(addr % sizeof(int) != 0)
+    return -1;
+
+  // copyin() may sleep to bring the page back in, so do it once
+  // before taking futex.lock; while this thread runs, swapout()
+  // leaves the page alone, so the second one will not.
+  if(copyin(p->pagetable, (char*)&cur, addr, sizeof(cur)) < 0)
+    return -1;
+  acquire(&futex.lock);
+  if(copyin(p->pagetable, (char*)&cur, addr, sizeof(cur)) < 0 || cur != val){
+    release(&futex.lock);
+    return -1;
+  }
+
+  w.pagetable = p->pagetable;
+  w.addr = addr;
+  w.woken = 0;
+  w.next = 0;
+  for(wp = bucket(w.pagetable, addr); *wp; wp = &(*wp)->next)
+    ;
+  *wp = &w;
+
+  while(!w.woken && !p->killed)
+    sleep(&w, &futex.lock);
+
+  if(!w.woken){
+    for(wp = bucket(w.pagetable, addr); *wp != &w; wp = &(*wp)->next)
+      ;
+    *wp = w.next;
+  }
+  release(&futex.lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n threads of the current process waiting on addr.
+// Returns the number woken.
+int
+futexwake(uint64 addr, int n)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+  struct fwait *w, **wp;
+  int woken = 0;
+
+  acquire(&futex.lock);
+  for(wp = bucket(pagetable, addr); *wp && woken < n; ){
+    w = *wp;
+    if(w->pagetable == pagetable && w->addr == addr){
+      *wp = w->next;
+      w->woken = 1;
+      wakeup(w);
+      woken++;
+    } else {
+      wp = &w->next;
+    }
+  }
+  release(&futex.lock);
+  return woken;
+}
@@ -1,6 +1,15 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// A page may be mapped by more than one process (see shm.c),
+// so each page has a reference count. kalloc() hands out a
+// page with one reference, kdup() adds one, and kfree() drops
+// one, returning the page to the free list with the last.
+//
+// kallocmega() hands out a 2-megabyte, 2-megabyte-aligned block
+// of MEGAPGSIZE/PGSIZE pages for a user megapage. It is just that
+// many pages, each with its own reference, freed one at a time.
 
 #include "types.h"
 #include "param.h"
@@ -16,11 +25,18 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;  // so kallocmega() can unlink any page
 };
 
+// index of physical page pa in kmem.ref[].
+#define PA2IDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;                              // pages on the free list
+  int ref[(PHYSTOP - KERNBASE) / PGSIZE]; // references to each page;
+                                          // 0 iff on the free list
 } kmem;
 
 void
@@ -35,14 +51,17 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kmem.ref[PA2IDX(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference is dropped.
 void
 kfree(void *pa)
 {
@@ -51,13 +70,30 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // the last reference stays until the page is on the free
+  // list, so that kallocmega() never sees it half-freed.
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2IDX(pa)] < 1)
+    panic("kfree: ref");
+  if(kmem.ref[PA2IDX(pa)] > 1){
+    kmem.ref[PA2IDX(pa)]--;
+    release(&kmem.lock);
+    return;
+  }
+  release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
   acquire(&kmem.lock);
+  kmem.ref[PA2IDX(pa)] = 0;
+  kmem.nfree++;
   r->next = kmem.freelist;
+  r->prev = 0;
+  if(kmem.freelist)
+    kmem.freelist->prev = r;
   kmem.freelist = r;
   release(&kmem.lock);
 }
@@ -72,11 +108,88 @@ kalloc(void)
 
   acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    if(kmem.freelist)
+      kmem.freelist->prev = 0;
+    kmem.ref[PA2IDX(r)] = 1;
+    kmem.nfree--;
+  }
   release(&kmem.lock);
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Allocate MEGAPGSIZE bytes of physical memory, aligned to
+// MEGAPGSIZE, if such a block happens to be entirely free.
+// Each page gets one reference. The memory is not initialized.
+// Returns 0 if there is no such block.
+void *
+kallocmega(void)
+{
+  uint64 pa, i, n = MEGAPGSIZE / PGSIZE;
+  struct run *r;
+
+  acquire(&kmem.lock);
+  for(pa = PHYSTOP - MEGAPGSIZE; pa >= (uint64)end; pa -= MEGAPGSIZE){
+    for(i = 0; i < n; i++){
+      if(kmem.ref[PA2IDX(pa) + i] != 0)
+        break;
+    }
+    if(i == n)
+      goto found;
+  }
+  release(&kmem.lock);
+  return 0;
+
+found:
+  for(i = 0; i < n; i++){
+    r = (struct run*)(pa + i*PGSIZE);
+    if(r->prev)
+      r->prev->next = r->next;
+    else
+      kmem.freelist = r->next;
+    if(r->next)
+      r->next->prev = r->prev;
+    kmem.ref[PA2IDX(r)] = 1;
+  }
+  kmem.nfree -= n;
+  release(&kmem.lock);
+  return (void*)pa;
+}
+
+// Add a reference to a page returned by kalloc(),
+// so that it takes one more kfree() to free it.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2IDX(pa)] < 1)
+    panic("kdup: free page");
+  kmem.ref[PA2IDX(pa)]++;
+  release(&kmem.lock);
+}
+
+// Return the number of free pages.
+int
+kfreepages(void)
+{
+  return kmem.nfree;
+}
+
+// Return the number of references to the page at pa.
+int
+krefcnt(void *pa)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[PA2IDX(pa)];
+  release(&kmem.lock);
+  return n;
+}
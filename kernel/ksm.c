@@ -0,0 +1,230 @@
+// Kernel same-page merging.
+//
+// ksmd is a kernel thread that finds user pages with the same
+// contents and makes them share one physical page, copy-on-write
+// (see uvmcow() in vm.c), freeing the others.
+//
+// Every KSMTICKS ticks it looks at the next KSMBATCH user pages
+// of processes that uvmquiet() allows, moving a cursor through
+// processes and addresses the way swap.c's clock hand does. It
+// keeps two tables:
+//
+//   stable:   pages that are already shared copy-on-write, by
+//             hash. ksmd holds a reference to each, so none is
+//             ever written in place.
+//   unstable: hashes of private pages seen during the current
+//             pass over all processes.
+//
+// A private page whose contents match a stable page is remapped
+// to it and freed. A private page whose hash is in unstable is
+// made copy-on-write where it is and becomes stable, so that the
+// page it matched is merged with it when the cursor comes by
+// again. The zero page is stable from the start. At the end of
+// each pass, stable pages nothing maps any more are freed, and
+// unstable is emptied.
+//
+// Only ksmd uses the tables. Page-table entries are changed with
+// the owner's p->lock held, as in swapout().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define KSMTICKS  10    // ticks between batches
+#define KSMBATCH  128   // pages looked at per batch
+#define NSTABLE   1024  // size of stable table
+#define NUNSTABLE 2048  // size of unstable table
+
+extern struct proc proc[NPROC];
+extern char *zeropage;   // vm.c
+
+uint ksmmerged;   // pages freed by merging
+
+struct stable {
+  uint64 hash;
+  uint64 pa;      // 0 if this entry is empty
+};
+
+static struct stable stable[NSTABLE];
+static struct stable old[NSTABLE];  // for ksmpass()
+static int nstable;
+static uint64 unstable[NUNSTABLE];  // 0 if empty
+static int nunstable;
+
+static struct proc *hand;  // next process to look at,
+static uint64 handva;      // and the next page in it
+
+static uint64
+pagehash(uint64 *pa)
+{
+  uint64 h = 14695981039346656037UL;
+
+  for(int i = 0; i < PGSIZE/sizeof(uint64); i++)
+    h = (h ^ pa[i]) * 1099511628211UL;
+  return h ? h : 1;
+}
+
+// Return the stable page with hash h and the same
+// contents as the page at pa, or 0.
+static uint64
+stablefind(uint64 h, uint64 pa)
+{
+  int i;
+
+  for(i = h % NSTABLE; stable[i].pa; i = (i + 1) % NSTABLE){
+    if(stable[i].hash == h && memcmp((void*)stable[i].pa, (void*)pa, PGSIZE) == 0)
+      return stable[i].pa;
+  }
+  return 0;
+}
+
+// Make the page at pa stable, taking a reference to it.
+// Returns -1 if the table is too full.
+static int
+stableadd(uint64 h, uint64 pa)
+{
+  int i;
+
+  if(nstable >= NSTABLE*3/4)
+    return -1;
+  for(i = h % NSTABLE; stable[i].pa; i = (i + 1) % NSTABLE)
+    ;
+  stable[i].hash = h;
+  stable[i].pa = pa;
+  nstable++;
+  kdup((void*)pa);
+  return 0;
+}
+
+// Is h in unstable? Add it if not.
+static int
+unstableseen(uint64 h)
+{
+  int i;
+
+  for(i = h % NUNSTABLE; unstable[i]; i = (i + 1) % NUNSTABLE){
+    if(unstable[i] == h)
+      return 1;
+  }
+  if(nunstable < NUNSTABLE*3/4){
+    unstable[i] = h;
+    nunstable++;
+  }
+  return 0;
+}
+
+// Called at the end of each pass over all processes.
+static void
+ksmpass(void)
+{
+  int i;
+
+  memmove(old, stable, sizeof(stable));
+  memset(stable, 0, sizeof(stable));
+  nstable = 0;
+  for(i = 0; i < NSTABLE; i++){
+    if(old[i].pa == 0)
+      continue;
+    if(krefcnt((void*)old[i].pa) > 1)
+      stableadd(old[i].hash, old[i].pa);
+    kfree((void*)old[i].pa);
+  }
+
+  memset(unstable, 0, sizeof(unstable));
+  nunstable = 0;
+}
+
+// Merge the user page *pte maps, if possible.
+// Returns 1 if *pte changed.
+// Caller must hold the owner's p->lock.
+static int
+ksmpage(pte_t *pte)
+{
+  uint64 pa, h, spa;
+
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U))
+    return 0;
+  pa = PTE2PA(*pte);
+  if(krefcnt((void*)pa) != 1)
+    return 0;
+
+  h = pagehash((uint64*)pa);
+  if((spa = stablefind(h, pa)) != 0){
+    kdup((void*)spa);
+    *pte = PA2PTE(spa) | ((PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW);
+    kfree((void*)pa);
+    ksmmerged++;
+    return 1;
+  }
+  if(unstableseen(h) && stableadd(h, pa) == 0){
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    return 1;
+  }
+  return 0;
+}
+
+// Look at the next KSMBATCH pages.
+static void
+ksmscan(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  int n, level, changed, done;
+
+  for(n = 0; n < KSMBATCH; n++){
+    p = hand;
+    changed = 0;
+    done = 1;
+    acquire(&p->lock);
+    if(uvmquiet(p)){
+      for(; handva < p->sz && n < KSMBATCH; handva += PGSIZE, n++){
+        level = 0;
+        if((pte = walklevel(p->pagetable, handva, &level, 0)) == 0)
+          continue;
+        if(level > 0)
+          handva = PGROUNDDOWN(handva | (MEGAPGSIZE-1));
+        else
+          changed |= ksmpage(pte);
+      }
+      done = handva >= p->sz;
+    }
+    if(changed)
+      uvmsync(p);
+    release(&p->lock);
+
+    if(done){
+      handva = 0;
+      if(++hand == &proc[NPROC]){
+        hand = proc;
+        ksmpass();
+      }
+    }
+  }
+}
+
+static void
+ksmd(void)
+{
+  uint ticks0;
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < KSMTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    ksmscan();
+  }
+}
+
+void
+ksminit(void)
+{
+  hand = proc;
+  stableadd(pagehash((uint64*)zeropage), (uint64)zeropage);
+  kthread("ksmd", ksmd);
+}
@@ -10,16 +10,39 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. A transaction is only closed when there are no FS
+// system calls active in it. Thus there is never any reasoning
+// required about whether a commit might write an uncommitted
+// system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves MAXOPBLOCKS blocks of
+// log space for the call; one that may write more, such as a
+// big write(), uses begin_opn()/end_opn() to reserve up to
+// log_opmax(). Usually begin_op() just increments the count
+// of in-progress FS system calls and returns. But if it thinks
+// the log is close to running out, it closes the transaction
+// and sleeps until the next one opens.
+//
+// The size of the log is chosen by mkfs and recorded in the
+// superblock, up to LOGSIZE blocks and a header.
+//
+// Transactions are committed by the logd kernel thread, so
+// end_op() does not wait for the disk. logd closes the open
+// transaction when it is full, when fsync() asks, or LOGTICKS
+// after its first update, and commits it while the system
+// calls of the next transaction go ahead. It keeps the closed
+// transaction's blocks locked until they are logged, so that
+// the next transaction does not change them underneath.
+//
+// Committed blocks are not written to their home locations
+// right away: they stay pinned in the cache, and the next
+// transactions are appended to the log after them. Only when
+// the log is full, or CKPTTICKS after the first of them
+// committed, does logd install them all, with new system
+// calls held off, and start the log over. So a block that every
+// transaction changes, such as the bitmap, goes home once per
+// checkpoint rather than once per commit.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,28 +51,60 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A block may be in the log more than once; the last copy is
+// the one that counts. The header also has a sequence number,
+// which goes up each time the log starts over, and a checksum
+// of it and of the block numbers and contents. Recovery only
+// believes a header whose checksum matches the log, so the
+// first commit after a checkpoint can write its log blocks and
+// the header all at once, and a checkpoint need not erase the
+// header: an old one either no longer matches the blocks after
+// it, or installs again what is already home. A later commit
+// still writes the header only after its log blocks, since a
+// torn one would take the earlier commits down with it.
+
+#define LOGTICKS 10    // longest a transaction stays open
+#define CKPTTICKS 100  // longest a committed block waits to go home
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  uint seq;    // which time round the log this is
+  uint cksum;  // of seq and the n blocks' numbers and contents
   int block[LOGSIZE];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // log blocks, header included
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they may write
+  int used;        // log blocks of closed transactions not installed
+  int closing;     // open transaction is to be committed; no new ops.
+  int ckpt;        // install the log after this commit
+  uint opened;     // ticks when the open transaction was first updated
+  uint dirtied;    // ticks when the first uninstalled commit was made
+  uint seq;        // number of the open transaction
+  uint done;       // number of the last transaction committed
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // the open transaction
+  struct logheader clh;  // what is in the on-disk log (logd's)
+
+  // used only by commit() and recovery.
+  struct buf *dbuf[LOGSIZE];  // blocks being logged or installed
+  struct buf *lbuf[LOGSIZE];  // log blocks in flight
 };
 struct log log;
 
+uint logcommits;   // transactions committed
+uint logblocks;    // blocks written to the log
+uint logckpts;     // checkpoints
+uint loginstalls;  // blocks written to their home locations
+
 static void recover_from_log(void);
-static void commit();
+static void logd(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -60,26 +115,80 @@ initlog(int dev, struct superblock *sb)
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  if(log.size > LOGSIZE+1)
+    log.size = LOGSIZE+1;  // use only what the header can name
+  if(log.size < MAXOPBLOCKS+1)
+    panic("initlog: log too small");
   log.dev = dev;
+
+  // a commit holds the blocks of two transactions and the log.
+  if(bsetmin(3*(log.size-1) + MAXOPBLOCKS) < 0)
+    panic("initlog: no memory for buffers");
+  log.seq = 1;
   recover_from_log();
+  kthread("logd", logd);
+}
+
+// Add a log block's number and contents to checksum h.
+static uint
+cksum(uint h, uint blockno, uchar *data)
+{
+  uint *w = (uint*)data;
+  int i;
+
+  // FNV-1a, a word at a time.
+  h = (h ^ blockno) * 16777619;
+  for (i = 0; i < BSIZE/sizeof(uint); i++)
+    h = (h ^ w[i]) * 16777619;
+  return h;
 }
 
-// Copy committed blocks from log to their home location
+// Is block blockno in log slots from..to-1?
+static int
+inlog(uint blockno, int from, int to)
+{
+  for (; from < to; from++) {
+    if (log.clh.block[from] == blockno)
+      return 1;
+  }
+  return 0;
+}
+
+// Copy committed blocks from log to their home location.
+// A block logged more than once is installed from its last
+// slot. Outside of recovery, the blocks are still pinned in
+// the cache with the contents that were last committed, so
+// only the writes are needed.
 static void
 install_trans(int recovering)
 {
-  int tail;
+  int tail, n = 0;
+  struct buf *lbuf, *dbuf;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+  if(recovering){
+    for (tail = 0; tail < log.clh.n; tail++)
+      bprefetch(log.dev, log.start+tail+1);
+  }
+  for (tail = 0; tail < log.clh.n; tail++) {
+    if(inlog(log.clh.block[tail], tail+1, log.clh.n))
+      continue;
+    dbuf = bread(log.dev, log.clh.block[tail]); // read dst
+    if(recovering){
+      lbuf = bread(log.dev, log.start+tail+1); // read log block
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bwrite_async(dbuf);  // write dst to disk
+    log.dbuf[n++] = dbuf;
+  }
+  for (tail = 0; tail < n; tail++) {
+    dbuf = log.dbuf[tail];
+    bwait(dbuf);
     if(recovering == 0)
       bunpin(dbuf);
-    brelse(lbuf);
     brelse(dbuf);
   }
+  loginstalls += n;
 }
 
 // Read the log header from disk into the in-memory log header
@@ -89,9 +198,13 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  log.clh.seq = lh->seq;
+  log.clh.cksum = lh->cksum;
+  if (log.clh.n < 0 || log.clh.n > log.size-1)
+    log.clh.n = -1;  // torn or garbage; see check_log()
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -105,56 +218,110 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.clh.n;
+  hb->seq = log.clh.seq;
+  hb->cksum = log.clh.cksum;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
   bwrite(buf);
   brelse(buf);
 }
 
+// Does the header just read match the blocks in the log?
+static int
+check_log(void)
+{
+  struct buf *b;
+  uint h = log.clh.seq;
+  int tail;
+
+  if (log.clh.n < 0)
+    return 0;
+  for (tail = 0; tail < log.clh.n; tail++)
+    bprefetch(log.dev, log.start+tail+1);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    b = bread(log.dev, log.start+tail+1);
+    h = cksum(h, log.clh.block[tail], b->data);
+    brelse(b);
+  }
+  return h == log.clh.cksum;
+}
+
+// Start the log over, empty, with the next sequence number.
+// The header on disk can stay as it is.
+static void
+restart_log(void)
+{
+  log.clh.n = 0;
+  log.clh.seq++;
+  log.clh.cksum = log.clh.seq;
+}
+
 static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  if (check_log())
+    install_trans(1); // if committed, copy from log to disk
+  restart_log();
+}
+
+// The most log blocks one FS system call can reserve.
+int
+log_opmax(void)
+{
+  int n = (log.size-1) / 2;
+
+  return n > MAXOPBLOCKS ? n : MAXOPBLOCKS;
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that writes
+// at most n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > log_opmax())
+    panic("begin_opn");
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.used + log.lh.n + log.reserved + n > log.size-1){
+      // this op might exhaust log space; commit what there is
+      // and install the log, or wait for other ops to end.
+      if(log.used + log.lh.n > 0){
+        log.closing = 1;
+        log.ckpt = 1;
+        wakeup(&log.lh);
+      }
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
-end_op(void)
+begin_op(void)
 {
-  int do_commit = 0;
+  begin_opn(MAXOPBLOCKS);
+}
 
+// called at the end of each FS system call, with the n it
+// passed to begin_opn(). lets logd commit if this was the last
+// outstanding operation of a closing transaction.
+void
+end_opn(int n)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  log.reserved -= n;
+  if(log.outstanding == 0 && log.closing){
+    wakeup(&log.lh);
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,43 +329,167 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Wait until everything the file system calls that have
+// returned so far did is committed to disk.
+void
+log_sync(void)
+{
+  uint want;
+
+  acquire(&log.lock);
+  if(log.lh.n == 0){
+    // only the transaction being committed, if any.
+    want = log.seq - 1;
+  } else {
+    want = log.seq;
+    log.closing = 1;
+    wakeup(&log.lh);
   }
+  while(log.done < want)
+    sleep(&log.done, &log.lock);
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Start copying the n modified blocks in log.dbuf[] from
+// cache to the log, at the end of what is there, and add
+// them to the header.
 static void
-write_log(void)
+write_log(int n)
 {
-  int tail;
+  int i, start = log.clh.n;
+  struct buf *to;
+
+  for (i = 0; i < n; i++)
+    log.lbuf[i] = bread_async(log.dev, log.start+start+i+1); // log block
+  for (i = 0; i < n; i++) {
+    to = log.lbuf[i];
+    bwait(to);
+    memmove(to->data, log.dbuf[i]->data, BSIZE);
+    bwrite_async(to);  // write the log
+    log.clh.cksum = cksum(log.clh.cksum, log.clh.block[start+i], to->data);
+  }
+  log.clh.n = start + n;
+}
+
+// Wait until the n log blocks from write_log() are on disk.
+static void
+wait_log(int n)
+{
+  for (int i = 0; i < n; i++) {
+    bwait(log.lbuf[i]);
+    brelse(log.lbuf[i]);
+  }
+}
+
+// Close the open transaction, whose ops have all ended, let
+// the next one start, and commit the closed one. Then install
+// the log if a checkpoint was asked for, before letting the
+// next transaction start.
+// Called only by logd.
+static void
+commit(void)
+{
+  uint seq;
+  int i, n, ckpt, old = log.clh.n;
+
+  // no op can change log.lh until closing is cleared. lock
+  // the blocks, so that the next transaction's ops wait until
+  // they are logged before changing them again.
+  n = log.lh.n;
+  for (i = 0; i < n; i++)
+    log.dbuf[i] = bread(log.dev, log.lh.block[i]);
+
+  acquire(&log.lock);
+  // the blocks go in the log after those not yet installed.
+  for (i = 0; i < n; i++)
+    log.clh.block[old+i] = log.lh.block[i];
+  log.lh.n = 0;
+  log.used += n;
+  ckpt = log.ckpt;
+  seq = log.seq++;
+  if(!ckpt){
+    log.closing = 0;
+    wakeup(&log);
+  }
+  release(&log.lock);
+
+  if (n > 0) {
+    logcommits++;
+    logblocks += n;
+    write_log(n);   // Write modified blocks from cache to log
+    if (old == 0) {
+      write_head(); // Write header to disk, at the same time
+      wait_log(n);  // -- the real commit
+    } else {
+      // a header that failed its checksum would lose the
+      // transactions already committed in the log as well.
+      wait_log(n);
+      write_head(); // -- the real commit
+    }
+    if (old == 0)
+      log.dirtied = ticks;
+    for (i = 0; i < n; i++) {
+      // keep one pin for each block in the log.
+      if (inlog(log.dbuf[i]->blockno, 0, old))
+        bunpin(log.dbuf[i]);
+      brelse(log.dbuf[i]);
+    }
+  }
+
+  acquire(&log.lock);
+  log.done = seq;
+  wakeup(&log.done);
+  release(&log.lock);
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  if (ckpt) {
+    if (log.clh.n > 0) {
+      logckpts++;
+      install_trans(0); // Now install writes to home locations
+      restart_log();
+    }
+    acquire(&log.lock);
+    log.used = 0;
+    log.ckpt = 0;
+    log.closing = 0;
+    wakeup(&log);
+    release(&log.lock);
   }
 }
 
+// The log daemon: commits the open transaction when it is
+// closing and its ops have ended, closing it itself once it
+// has been open for LOGTICKS, or to install the log once it
+// has held committed blocks for CKPTTICKS.
 static void
-commit()
+logd(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  acquire(&log.lock);
+  for(;;){
+    if(!log.closing){
+      if(log.lh.n > 0 && ticks - log.opened >= LOGTICKS)
+        log.closing = 1;
+      if(log.used > 0 && ticks - log.dirtied >= CKPTTICKS){
+        log.closing = 1;
+        log.ckpt = 1;
+      }
+    }
+    if(log.closing && log.outstanding == 0){
+      release(&log.lock);
+      commit();
+      acquire(&log.lock);
+    } else if(!log.closing && (log.lh.n > 0 || log.used > 0)){
+      sleep(&ticks, &log.lock);
+    } else {
+      sleep(&log.lh, &log.lock);
+    }
   }
 }
 
@@ -217,7 +508,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.used + log.lh.n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -229,8 +520,12 @@ log_write(struct buf *b)
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
+    if (log.lh.n == 0) {
+      // start logd's clock.
+      log.opened = ticks;
+      wakeup(&log.lh);
+    }
     log.lh.n++;
   }
   release(&log.lock);
 }
-
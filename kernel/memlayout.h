@@ -60,8 +60,17 @@
 //   text
 //   original data and bss
 //   fixed-size stack
-//   expandable heap
+//   expandable heap, up to USERTOP
 //   ...
-//   TRAPFRAME (p->trapframe, used by the trampoline)
+//   ...
+//   shared memory attachment slots (see shm.c)
+//   TRAPFRAMEs (p->trapframe of each thread, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
-#define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define TRAPFRAMEVA(t) (TRAMPOLINE - ((t)+1) * PGSIZE)
+#define TRAPFRAME TRAPFRAMEVA(0)
+
+// a process's kernel page table maps its user memory below
+// USERTOP too (see kvmsync()), so it must end below the
+// devices the kernel maps.
+#define USERTOP PLIC
+#define SHMVA(slot) (TRAPFRAMEVA(NTHREAD-1) - ((slot)+1) * SHMMAXPAGES * PGSIZE)
@@ -7,7 +7,13 @@
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      252  // max data blocks in on-disk log (header fits a block)
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define FSSIZE       6096  // default size of disk image in blocks, swap area included
+#define SWAPBLOCKS   4096  // blocks at the end of the disk used for swapping
 #define MAXPATH      128   // maximum file path name
+#define NSHM         16    // maximum number of shared memory segments
+#define NSHMPROC     4     // shared memory segments attached per process
+#define SHMMAXPAGES  256   // maximum pages in a shared memory segment
+#define NTHREAD      8     // maximum threads per process
+#define NREADAHEAD   16    // blocks to read ahead of a sequential reader
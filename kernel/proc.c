@@ -12,6 +12,8 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+static struct tgroup tgroup[NPROC];
+
 uint running_processes_mean = 0;
 uint runnable_processes_mean = 0;
 uint sleeping_processes_mean = 0;
@@ -21,15 +23,28 @@ uint procs_num = 0;
 int nextpid = 1;
 int rate= 5;
 struct spinlock pid_lock;
+
+// address-space IDs; see usersatp().
+int nextasid = 1;
+int maxasid = 0;     // largest ASID the hardware supports; 0 if none
+uint64 asidgen = 1;  // current ASID generation
+struct spinlock asid_lock;
 uint time_to = 0;
 uint program_time = 0;
 uint start_time = 0;
 uint cpu_utilization = 0;
 
+extern uint swapins, swapouts;  // swap.c
+extern uint ksmmerged;          // ksm.c
+extern uint bhits, bmisses, bcontended, nbuf, bprefetches;  // bio.c
+extern uint logcommits, logblocks, logckpts, loginstalls;  // log.c
+
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
@@ -61,10 +76,23 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&asid_lock, "asid");
+#ifndef NOASID
+  // find out how many ASID bits the hardware implements.
+  uint64 satp = r_satp();
+  w_satp(satp | SATP_ASID(0xFFFF));
+  maxasid = (r_satp() >> 44) & 0xFFFF;
+  w_satp(satp);
+  sfence_vma();
+  if(maxasid < 2)
+    maxasid = 0;
+#endif
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
   }
+  for(struct tgroup *tg = tgroup; tg < &tgroup[NPROC]; tg++)
+      initlock(&tg->lock, "tgroup");
 
   start_time = ticks;
 }
@@ -110,12 +138,238 @@ allocpid() {
   return pid;
 }
 
+// Make sure p has ASIDs of the current generation.
+// Returns 1 if this cpu must flush its TLB before
+// switching satp to one of p's page tables.
+//
+// ASIDs tag TLB entries, so the TLB need not be flushed
+// when satp switches to a page table with its own ASID. A
+// process has two: p->asid for its user page table and
+// p->asid+1 for its kernel page table. They are handed out
+// in order. When they run out, a new generation starts: every
+// process's ASIDs become stale, and each cpu flushes its TLB
+// once before it uses any ASID of the new generation.
+// ASID 0 is kernel_pagetable's.
+//
+// Interrupts must be off.
+int
+asidcheck(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int flush;
+
+  if(maxasid == 0)
+    return 1;
+
+  acquire(&asid_lock);
+  if(p->asidgen != asidgen){
+    if(nextasid + 1 > maxasid){
+      asidgen++;
+      nextasid = 1;
+    }
+    p->asid = nextasid;
+    nextasid += 2;
+    p->asidgen = asidgen;
+  }
+  flush = c->asidgen != asidgen;
+  c->asidgen = asidgen;
+  release(&asid_lock);
+  return flush;
+}
+
+// satp values for p's user and kernel page tables.
+// Call asidcheck() first.
+uint64
+usersatp(struct proc *p)
+{
+  if(maxasid == 0)
+    return MAKE_SATP(p->pagetable);
+  return MAKE_SATP(p->pagetable) | SATP_ASID(p->asid);
+}
+
+uint64
+kernelsatp(struct proc *p)
+{
+  if(maxasid == 0)
+    return MAKE_SATP(p->kpagetable);
+  return MAKE_SATP(p->kpagetable) | SATP_ASID(p->asid + 1);
+}
+
+// p's user page table has changed. Map the same user memory
+// in p's kernel page table, and give up p's ASIDs, since TLB
+// entries tagged with them may now be stale on any cpu; p
+// gets fresh ones, which no TLB has entries for, when it
+// next runs. If p is running here, switch to them now.
+// The same goes for the other threads that share the page
+// table, though they are not switched until they next run.
+void
+uvmsync(struct proc *p)
+{
+  struct proc *q;
+  int flush;
+
+  if(p->tg && p->tg->nthread > 1){
+    for(q = proc; q < &proc[NPROC]; q++){
+      if(q == p || q->tg != p->tg)
+        continue;
+      acquire(&q->lock);
+      if(q->tg == p->tg && q->kpagetable){
+        kvmsync(q->kpagetable, q->pagetable);
+        acquire(&asid_lock);
+        q->asidgen = 0;
+        release(&asid_lock);
+      }
+      release(&q->lock);
+    }
+  }
+
+  kvmsync(p->kpagetable, p->pagetable);
+  acquire(&asid_lock);
+  p->asidgen = 0;
+  release(&asid_lock);
+
+  if(p == myproc()){
+    push_off();
+    flush = asidcheck(p);
+    w_satp(kernelsatp(p));
+    if(flush)
+      sfence_vma();
+    pop_off();
+  }
+}
+
+// Run p on cpu c, in p's kernel page table, until it
+// gives the cpu back. c must hold p->lock.
+static void
+runproc(struct cpu *c, struct proc *p)
+{
+  int flush;
+
+  if(p->kpagetable){
+    flush = asidcheck(p);
+    w_satp(kernelsatp(p));
+    if(flush)
+      sfence_vma();
+  }
+  swtch(&c->context, &p->context);
+
+  // p's kernel page table may be freed once p has exited.
+  w_satp(MAKE_SATP(kernel_pagetable));
+}
+
+// Find an unused thread group for a new process, with
+// the process as its only thread, in trapframe slot 0.
+static struct tgroup*
+tgalloc(void)
+{
+  struct tgroup *tg;
+
+  for(tg = tgroup; tg < &tgroup[NPROC]; tg++){
+    acquire(&tg->lock);
+    if(tg->ref == 0){
+      tg->ref = 1;
+      tg->nthread = 1;
+      memset(tg->tslot, 0, sizeof(tg->tslot));
+      tg->tslot[0] = 1;
+      release(&tg->lock);
+      return tg;
+    }
+    release(&tg->lock);
+  }
+  return 0;
+}
+
+// Add a new thread to tg, setting *tslot to a free
+// trapframe slot for it. Returns 0 if there is none.
+static struct tgroup*
+tgjoin(struct tgroup *tg, int *tslot)
+{
+  int t;
+
+  acquire(&tg->lock);
+  for(t = 0; t < NTHREAD; t++){
+    if(!tg->tslot[t]){
+      tg->tslot[t] = 1;
+      tg->ref++;
+      tg->nthread++;
+      release(&tg->lock);
+      *tslot = t;
+      return tg;
+    }
+  }
+  release(&tg->lock);
+  return 0;
+}
+
+// p no longer uses its thread group. If other procs do, just
+// take p's trapframe out of the shared page table; otherwise
+// free the page table, and the group.
+static void
+tgput(struct proc *p)
+{
+  struct tgroup *tg = p->tg;
+
+  acquire(&tg->lock);
+  if(p->state == USED)
+    tg->nthread--;  // never ran, so exit() did not
+  if(tg->ref > 1){
+    if(p->pagetable)
+      uvmunmap(p->pagetable, TRAPFRAMEVA(p->tslot), 1, 0);
+    tg->tslot[p->tslot] = 0;
+    tg->ref--;
+    release(&tg->lock);
+    return;
+  }
+  release(&tg->lock);
+
+  // the last one; no one else can get at tg now.
+  if(p->pagetable){
+    shmdetachall(p);
+    proc_freepagetable(p->pagetable, p->sz);
+  }
+  shmexit(tg);
+  acquire(&tg->lock);
+  tg->ref = 0;
+  release(&tg->lock);
+}
+
+// Wait until no other thread of tg is changing the size of
+// its memory, and keep them from starting to.
+static void
+tglockmem(struct tgroup *tg)
+{
+  acquire(&tg->lock);
+  while(tg->growing)
+    sleep(tg, &tg->lock);
+  tg->growing = 1;
+  release(&tg->lock);
+}
+
+// Set the size of every thread's memory to sz, and
+// let the next thread in tglockmem() go.
+static void
+tgunlockmem(struct tgroup *tg, uint64 sz)
+{
+  struct proc *q;
+
+  for(q = proc; q < &proc[NPROC]; q++){
+    if(q->tg == tg)
+      q->sz = sz;
+  }
+  acquire(&tg->lock);
+  tg->growing = 0;
+  wakeup(tg);
+  release(&tg->lock);
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. The new proc is a thread
+// sharing share's memory, files and directory, or a new
+// process with an empty page table if share is 0.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *share)
 {
   struct proc *p;
 
@@ -133,6 +387,19 @@ found:
   p->pid = allocpid();
   p->state = USED;
 
+  // Join share's thread group, or start a new one.
+  if(share)
+    p->tg = tgjoin(share->tg, &p->tslot);
+  else {
+    p->tg = tgalloc();
+    p->tslot = 0;
+  }
+  if(p->tg == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
     freeproc(p);
@@ -140,9 +407,27 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+  if(share){
+    // Map the trapframe in share's page table, in p's slot.
+    if(mappages(share->pagetable, TRAPFRAMEVA(p->tslot), PGSIZE,
+                (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    p->pagetable = share->pagetable;
+  } else {
+    // An empty user page table.
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+  }
+
+  // A kernel page table that will map the same user memory.
+  if((p->kpagetable = kvmcreate()) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -166,9 +451,15 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+  if(p->tg)
+    tgput(p);
+  p->tg = 0;
   p->pagetable = 0;
+  p->isthread = 0;
+  if(p->kpagetable)
+    kvmfree(p->kpagetable);
+  p->kpagetable = 0;
+  p->asidgen = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -209,8 +500,8 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe just below TRAMPOLINE, for trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
+  // map the trapframe below TRAMPOLINE, in p's slot, for trampoline.S.
+  if(mappages(pagetable, TRAPFRAMEVA(p->tslot), PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
@@ -225,8 +516,14 @@ proc_pagetable(struct proc *p)
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
+  pte_t *pte;
+
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  // the trapframes of whatever threads still use it.
+  for(int t = 0; t < NTHREAD; t++){
+    if((pte = walk(pagetable, TRAPFRAMEVA(t), 0)) != 0 && (*pte & PTE_V))
+      uvmunmap(pagetable, TRAPFRAMEVA(t), 1, 0);
+  }
   uvmfree(pagetable, sz);
 }
 
@@ -248,44 +545,62 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
   p->sz = PGSIZE;
+  uvmsync(p);
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  p->tg->cwd = namei("/");
 
   p->state = RUNNABLE;
 
   release(&p->lock);
 }
 
-// Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Grow or shrink user memory by n bytes, for all
+// threads of the process.
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint sz;
+  uint64 sz, oldsz;
   struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
 
-  sz = p->sz;
+  tglockmem(tg);
+  oldsz = sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
+    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0)
+      goto bad;
+    // see clone().
+    if(tg->nthread > 1 && uvmprivate(p->pagetable, oldsz, sz) < 0){
+      uvmdealloc(p->pagetable, sz, oldsz);
+      goto bad;
     }
   } else if(n < 0){
+    // another thread may still reach the pages through
+    // its TLB on another cpu, and there is no way to
+    // make it let go.
+    if(tg->nthread > 1)
+      goto bad;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
-  return 0;
+  tgunlockmem(tg, sz);
+  uvmsync(p);
+  return oldsz;
+
+ bad:
+  tgunlockmem(tg, oldsz);
+  return -1;
 }
 
 // Create a new process, copying the parent.
@@ -298,17 +613,30 @@ fork(void)
   struct proc *p = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
+  // uvmcopy() may sleep to swap. np is not RUNNABLE
+  // yet, so nothing else will touch it meanwhile.
+  release(&np->lock);
 
   // Copy user memory from parent to child.
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+    acquire(&np->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  uvmsync(np);
+
+  // Share p's shared memory attachments.
+  if(shmfork(p, np) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -317,17 +645,83 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  acquire(&p->tg->lock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+    if(p->tg->ofile[i])
+      np->tg->ofile[i] = filedup(p->tg->ofile[i]);
+  np->tg->cwd = idup(p->tg->cwd);
+  release(&p->tg->lock);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
   release(&np->lock);
 
+  return pid;
+}
+
+// Create a new process running the program in path with argv,
+// like fork() followed by exec() in the child, but without
+// copying the caller's memory. If fds is 0 the child gets all
+// of the caller's open files, as with fork(); otherwise its
+// fds 0, 1 and 2 are the caller's fds[0], fds[1] and fds[2]
+// (-1 leaves one closed) and it has no others.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fds)
+{
+  int i, fd, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if(fds){
+    for(i = 0; i < 3; i++){
+      fd = fds[i];
+      if(fd != -1 && (fd < 0 || fd >= NOFILE || p->tg->ofile[fd] == 0))
+        return -1;
+    }
+  }
+
+  // Allocate process.
+  if((np = allocproc(0)) == 0){
+    return -1;
+  }
+  // exec() sleeps; np is not RUNNABLE yet, so nothing
+  // else will touch it meanwhile.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = exec(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  acquire(&p->tg->lock);
+  if(fds){
+    // another thread may have closed one since the check.
+    for(i = 0; i < 3; i++)
+      if(fds[i] != -1 && p->tg->ofile[fds[i]])
+        np->tg->ofile[i] = filedup(p->tg->ofile[fds[i]]);
+  } else {
+    for(i = 0; i < NOFILE; i++)
+      if(p->tg->ofile[i])
+        np->tg->ofile[i] = filedup(p->tg->ofile[i]);
+  }
+  np->tg->cwd = idup(p->tg->cwd);
+  release(&p->tg->lock);
+
+  pid = np->pid;
+
   acquire(&wait_lock);
   np->parent = p;
   release(&wait_lock);
@@ -339,6 +733,63 @@ fork(void)
   return pid;
 }
 
+// Start a new thread in the current process, sharing its
+// memory, open files and current directory, that runs fn(arg)
+// in user space on the stack whose top is stack. fn must not
+// return; the thread ends with exit().
+// Returns the new thread's id, a pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int tid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
+
+  tglockmem(tg);
+  if((np = allocproc(p)) == 0){
+    tgunlockmem(tg, p->sz);
+    return -1;
+  }
+  release(&np->lock);
+
+  // When a thread breaks copy-on-write, another thread may still
+  // have the old page in its TLB on another cpu, and xv6 has no
+  // way to make it flush. So a process with threads keeps all of
+  // its pages private: this makes them so, growproc() keeps new
+  // ones so, and swapout() and ksmd leave them alone. uvmsync()
+  // tells the new thread's kernel page table about them.
+  if(uvmprivate(p->pagetable, 0, p->sz) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    tgunlockmem(tg, p->sz);
+    return -1;
+  }
+  tgunlockmem(tg, p->sz);
+  uvmsync(p);
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack & ~15;
+  np->isthread = 1;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  tid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return tid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -348,36 +799,56 @@ reparent(struct proc *p)
 
   for(pp = proc; pp < &proc[NPROC]; pp++){
     if(pp->parent == p){
+      // init wait()s for an orphaned thread like any other.
       pp->parent = initproc;
+      pp->isthread = 0;
       wakeup(initproc);
     }
   }
 }
 
-// Exit the current process.  Does not return.
-// An exited process remains in the zombie state
-// until its parent calls wait().
+// Exit the current thread.  Does not return.
+// An exited thread remains in the zombie state
+// until its parent calls wait(), or join() for a
+// thread made by clone(). The process's memory and
+// files go when its last thread exits.
 void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
+  int last;
 
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
+  acquire(&tg->lock);
+  last = --tg->nthread == 0;
+  release(&tg->lock);
+
+  if(last){
+    // Close all open files.
+    for(int fd = 0; fd < NOFILE; fd++){
+      if(tg->ofile[fd]){
+        struct file *f = tg->ofile[fd];
+        fileclose(f);
+        tg->ofile[fd] = 0;
+      }
     }
-  }
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+    begin_op();
+    iput(tg->cwd);
+    end_op();
+    tg->cwd = 0;
+  } else {
+    // let go of the memory now, so that the other threads
+    // can exec() without waiting for a join().
+    tgput(p);
+    acquire(&p->lock);
+    p->tg = 0;
+    p->pagetable = 0;
+    release(&p->lock);
+  }
 
   acquire(&wait_lock);
 
@@ -409,13 +880,16 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child to exit and return its pid: a child
+// process if thread is 0, else a thread made by clone(), the
+// one with id tid unless tid is 0. Its exit status is copied
+// out to addr, if not 0.
+// Return -1 if there are no such children.
+static int
+reap(int thread, int tid, uint64 addr)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -424,7 +898,8 @@ wait(uint64 addr)
     // Scan through table looking for exited children.
     havekids = 0;
     for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
+      if(np->parent == p && np->isthread == thread &&
+         (tid == 0 || np->pid == tid)){
         // make sure the child isn't still in exit() or swtch().
         acquire(&np->lock);
 
@@ -432,15 +907,15 @@ wait(uint64 addr)
         if(np->state == ZOMBIE){
           // Found one.
           pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = np->xstate;
           freeproc(np);
           release(&np->lock);
           release(&wait_lock);
+          // copyout() may sleep, to swap a page in or
+          // break copy-on-write, so not with locks held.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&np->lock);
@@ -458,6 +933,23 @@ wait(uint64 addr)
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr)
+{
+  return reap(0, 0, addr);
+}
+
+// Wait for thread tid, or any thread if tid is 0, that this
+// thread made with clone() to exit, and return its id.
+// Return -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  return reap(1, tid, addr);
+}
+
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -486,7 +978,7 @@ rr_scheduler(void)
         p->runnable_time += ticks0 - p->start_runnable;
         p->state = RUNNING;
         c->proc = p;
-        swtch(&c->context, &p->context);
+        runproc(c, p);
         p->running_time += ticks - ticks0;
         // Process is done running for now.
         // It should have changed its p->state before coming back.
@@ -533,7 +1025,7 @@ fcfs_scheduler(void){
           p->runnable_time += ticks0 - p->start_runnable;
           p->state = RUNNING;
           c->proc = p;
-          swtch(&c->context, &p->context);
+          runproc(c, p);
           
           p->running_time += ticks - ticks0;
           // Process is done running for now.
@@ -577,7 +1069,7 @@ approx_sjf_scheduler(void){
           p->runnable_time += ticks0 - p->start_runnable;
           p->state = RUNNING;
           c->proc = p;
-          swtch(&c->context, &p->context);
+          runproc(c, p);
           uint ticks1 = ticks;
           p->running_time += ticks1 - ticks0;
           p->last_ticks = ticks1 - ticks0;
@@ -653,6 +1145,59 @@ yield(void)
   release(&p->lock);
 }
 
+// May p's user pages be changed behind its back, by swapout()
+// or ksmd? Only if it is not running, and not stopped in the
+// middle of kernel code that may have one of them in hand. A
+// process that sleeps has let go of (or rechecks) any such page,
+// but one preempted by kerneltrap() may not have. Never if p has
+// other threads, which may be using the pages (see clone()).
+// Caller must hold p->lock.
+int
+uvmquiet(struct proc *p)
+{
+  return p->pagetable != 0 && p->tg->nthread == 1 &&
+    (p->state == SLEEPING || (p->state == RUNNABLE && !p->kpreempted));
+}
+
+// Start a kernel thread that runs fn(), which must not return.
+// It has no user memory, pid 0 and no parent, so wait() leaves
+// it alone, and kill() passes over it (see p->kfn); scheduler()
+// runs it on kernel_pagetable.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++) {
+    acquire(&p->lock);
+    if(p->state == UNUSED)
+      goto found;
+    release(&p->lock);
+  }
+  panic("kthread");
+
+found:
+  p->pid = 0;
+  p->kfn = fn;
+  memset(&p->context, 0, sizeof(p->context));
+  p->context.ra = (uint64)kthreadret;
+  p->context.sp = p->kstack + PGSIZE;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -738,7 +1283,7 @@ kill(int pid)
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
-    if(p->pid == pid){
+    if(p->pid == pid && p->state != UNUSED && p->kfn == 0){
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
@@ -845,5 +1390,13 @@ kill_system(void){
 int
 print_stats(void){
   printf("\nProgram time: %d\nCPU utilization: %d\n", program_time, cpu_utilization);
+  printf("Swap-ins: %d\nSwap-outs: %d\n", swapins, swapouts);
+  printf("KSM merged pages: %d\n", ksmmerged);
+  printf("Buffer cache hits: %d\nBuffer cache misses: %d\n", bhits, bmisses);
+  printf("Buffer cache bucket lock contention: %d\n", bcontended);
+  printf("Buffer cache size: %d blocks\n", nbuf);
+  printf("Buffer cache read-aheads: %d\n", bprefetches);
+  printf("Log commits: %d\nLog blocks written: %d\n", logcommits, logblocks);
+  printf("Log checkpoints: %d\nLog blocks installed: %d\n", logckpts, loginstalls);
   return 0;
 }
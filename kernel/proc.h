@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this cpu's TLB has been flushed for.
 };
 
 extern struct cpu cpus[NCPU];
@@ -82,6 +83,24 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// What the threads of a process share, besides the user page
+// table. A process made by fork() or spawn() has a thread group
+// of its own; clone() adds threads to the caller's.
+struct tgroup {
+  struct spinlock lock;
+  int ref;                     // procs using it, zombies included
+  int nthread;                 // threads that have not exited
+  int growing;                 // a thread is changing sz; see tggrow()
+  char tslot[NTHREAD];         // which trapframe slots are in use
+
+  // tg->lock must be held to change these:
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+
+  // shm.lock must be held when using this:
+  struct shmseg *shm[NSHMPROC]; // Attached shared memory segments
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -99,12 +118,18 @@ struct proc {
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  pagetable_t pagetable;       // User page table, shared by the thread group
+  struct tgroup *tg;           // Thread group
+  int tslot;                   // trapframe is mapped at TRAPFRAMEVA(tslot)
+  int isthread;                // made by clone(); join() it, not wait()
+  pagetable_t kpagetable;      // Kernel page table, also mapping user memory
+  int asid;                    // Address-space ID, valid if asidgen is current
+  uint64 asidgen;              // Generation asid was allocated in, or 0
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // what a kernel thread runs; see kthread()
+  int kpreempted;              // yielded in kerneltrap(); see uvmquiet()
   uint last_runnable_time;
   uint mean_ticks;
   uint last_ticks;
@@ -0,0 +1,261 @@
+// Shared memory segments.
+//
+// A segment is a set of physical pages that several processes
+// map into their address spaces at the same time, so that they
+// can exchange data without copying it through the kernel.
+//
+// Segments are named by a key chosen by the processes that share
+// them. shmget() finds or creates the segment for a key and
+// returns its id; key 0 always creates a new, private segment,
+// which can still be shared with children since fork() keeps
+// attachments. shmattach() maps a segment into the calling
+// process and shmdetach() unmaps it. A segment is destroyed when
+// the last process that has it attached detaches, execs or exits,
+// or, if no process ever attached it, when its creator exits.
+//
+// Each attachment takes a kalloc() reference on every page of
+// the segment, and the segment holds one more of its own, so a
+// page is freed only when nothing refers to it any longer.
+//
+// A process has NSHMPROC attachment slots (p->tg->shm[]), shared
+// by its threads. Slot i is always mapped at SHMVA(i), far above
+// the heap.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct shmseg {
+  int key;                  // name chosen by shmget() callers, 0 if private
+  int npages;               // size; 0 if this segment is unused
+  int nattach;              // number of process attachments
+  struct tgroup *creator;   // until the first attachment
+  uint64 pa[SHMMAXPAGES];   // physical pages
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shm;
+
+void
+shminit(void)
+{
+  initlock(&shm.lock, "shm");
+}
+
+// Free the pages of an unused segment.
+// Caller must hold shm.lock.
+static void
+shmfree(struct shmseg *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++)
+    kfree((void*)s->pa[i]);
+  s->npages = 0;
+  s->key = 0;
+  s->creator = 0;
+}
+
+// Return the id of the segment named key, creating it with
+// room for size bytes if it does not exist yet.
+// Returns -1 if size is too big or no segment is free.
+int
+shmget(int key, int size)
+{
+  struct shmseg *s;
+  int npages;
+  char *mem;
+
+  if(size < 0)
+    return -1;
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(npages > SHMMAXPAGES)
+    return -1;
+
+  acquire(&shm.lock);
+  if(key != 0){
+    for(s = shm.seg; s < &shm.seg[NSHM]; s++){
+      if(s->npages > 0 && s->key == key){
+        release(&shm.lock);
+        if(npages > s->npages)
+          return -1;
+        return s - shm.seg;
+      }
+    }
+  }
+
+  if(npages == 0){
+    release(&shm.lock);
+    return -1;
+  }
+  for(s = shm.seg; s < &shm.seg[NSHM]; s++){
+    if(s->npages == 0)
+      goto found;
+  }
+  release(&shm.lock);
+  return -1;
+
+found:
+  for(; s->npages < npages; s->npages++){
+    if((mem = kalloc()) == 0){
+      shmfree(s);
+      release(&shm.lock);
+      return -1;
+    }
+    memset(mem, 0, PGSIZE);
+    s->pa[s->npages] = (uint64)mem;
+  }
+  s->key = key;
+  s->nattach = 0;
+  s->creator = myproc()->tg;
+  release(&shm.lock);
+  return s - shm.seg;
+}
+
+// Map the pages of s at va in pagetable, taking a
+// reference on each. Caller must hold shm.lock.
+static int
+shmmap(pagetable_t pagetable, struct shmseg *s, uint64 va)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++){
+    if(mappages(pagetable, va + i*PGSIZE, PGSIZE, s->pa[i], PTE_W|PTE_R|PTE_U) != 0){
+      uvmunmap(pagetable, va, i, 1);
+      return -1;
+    }
+    kdup((void*)s->pa[i]);
+  }
+  return 0;
+}
+
+// Undo p's attachment in slot, destroying the segment
+// if that was its last one. Caller must hold shm.lock.
+static void
+shmunmap(struct proc *p, int slot)
+{
+  struct shmseg *s = p->tg->shm[slot];
+
+  uvmunmap(p->pagetable, SHMVA(slot), s->npages, 1);
+  p->tg->shm[slot] = 0;
+  if(--s->nattach == 0)
+    shmfree(s);
+}
+
+// Map segment id into the current process.
+// Returns the address it is mapped at, or -1.
+uint64
+shmattach(int id)
+{
+  struct proc *p = myproc();
+  struct shmseg *s;
+  int slot;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+
+  acquire(&shm.lock);
+  s = &shm.seg[id];
+  if(s->npages == 0)
+    goto bad;
+  for(slot = 0; slot < NSHMPROC; slot++){
+    if(p->tg->shm[slot] == 0)
+      break;
+  }
+  if(slot == NSHMPROC)
+    goto bad;
+  if(shmmap(p->pagetable, s, SHMVA(slot)) < 0)
+    goto bad;
+  s->nattach++;
+  s->creator = 0;
+  p->tg->shm[slot] = s;
+  release(&shm.lock);
+  uvmsync(p);
+  return SHMVA(slot);
+
+ bad:
+  release(&shm.lock);
+  return -1;
+}
+
+// Unmap the segment attached at va from the current process.
+// Not while it has other threads, which may still reach the
+// pages through their TLBs (see growproc()).
+int
+shmdetach(uint64 va)
+{
+  struct proc *p = myproc();
+  int slot;
+
+  if(p->tg->nthread > 1)
+    return -1;
+  acquire(&shm.lock);
+  for(slot = 0; slot < NSHMPROC; slot++){
+    if(p->tg->shm[slot] && SHMVA(slot) == va){
+      shmunmap(p, slot);
+      release(&shm.lock);
+      uvmsync(p);
+      return 0;
+    }
+  }
+  release(&shm.lock);
+  return -1;
+}
+
+// Give child np the same attachments as p, at the same addresses.
+// On failure, some may have been made; freeproc() undoes them.
+int
+shmfork(struct proc *p, struct proc *np)
+{
+  int slot;
+
+  acquire(&shm.lock);
+  for(slot = 0; slot < NSHMPROC; slot++){
+    if(p->tg->shm[slot] == 0)
+      continue;
+    if(shmmap(np->pagetable, p->tg->shm[slot], SHMVA(slot)) < 0){
+      release(&shm.lock);
+      return -1;
+    }
+    p->tg->shm[slot]->nattach++;
+    np->tg->shm[slot] = p->tg->shm[slot];
+  }
+  release(&shm.lock);
+  return 0;
+}
+
+// Detach every segment p has attached.
+// Called by exec() and when p is freed.
+void
+shmdetachall(struct proc *p)
+{
+  int slot;
+
+  acquire(&shm.lock);
+  for(slot = 0; slot < NSHMPROC; slot++){
+    if(p->tg->shm[slot])
+      shmunmap(p, slot);
+  }
+  release(&shm.lock);
+}
+
+// Destroy the segments tg created that were never attached.
+// Called when the last thread of tg is freed.
+void
+shmexit(struct tgroup *tg)
+{
+  struct shmseg *s;
+
+  acquire(&shm.lock);
+  for(s = shm.seg; s < &shm.seg[NSHM]; s++){
+    if(s->npages > 0 && s->creator == tg)
+      shmfree(s);
+  }
+  release(&shm.lock);
+}
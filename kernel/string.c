@@ -1,13 +1,42 @@
 #include "types.h"
 
+// memset and memmove work a 64-bit word at a time, eight
+// words per loop, once the pointers are word-aligned; only
+// unaligned edges go a byte at a time.
+
+#define WSIZE sizeof(uint64)
+#define ALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 *w, word;
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+
+  word = (uchar)c;
+  word |= word << 8;
+  word |= word << 16;
+  word |= word << 32;
+  w = (uint64*)cdst;
+  for(; n >= 8*WSIZE; n -= 8*WSIZE, w += 8){
+    w[0] = word;
+    w[1] = word;
+    w[2] = word;
+    w[3] = word;
+    w[4] = word;
+    w[5] = word;
+    w[6] = word;
+    w[7] = word;
   }
+  for(; n >= WSIZE; n -= WSIZE)
+    *w++ = word;
+
+  cdst = (char*)w;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -32,6 +61,8 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd;
 
   if(n == 0)
     return dst;
@@ -39,13 +70,57 @@ memmove(void *dst, const void *src, uint n)
   s = src;
   d = dst;
   if(s < d && s + n > d){
+    // overlapping, so copy backwards.
     s += n;
     d += n;
+    if(((uint64)s & (WSIZE-1)) == ((uint64)d & (WSIZE-1))){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *--d = *--s;
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE){
+        ws -= 8;
+        wd -= 8;
+        wd[7] = ws[7];
+        wd[6] = ws[6];
+        wd[5] = ws[5];
+        wd[4] = ws[4];
+        wd[3] = ws[3];
+        wd[2] = ws[2];
+        wd[1] = ws[1];
+        wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(((uint64)s & (WSIZE-1)) == ((uint64)d & (WSIZE-1))){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *d++ = *s++;
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE, ws += 8, wd += 8){
+        wd[0] = ws[0];
+        wd[1] = ws[1];
+        wd[2] = ws[2];
+        wd[3] = ws[3];
+        wd[4] = ws[4];
+        wd[5] = ws[5];
+        wd[6] = ws[6];
+        wd[7] = ws[7];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const char*)ws;
+      d = (char*)wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
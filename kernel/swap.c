@@ -0,0 +1,269 @@
+// Swapping of user pages to disk.
+//
+// mkfs reserves sb.nswap blocks at the end of the disk, after
+// the file system, as a swap area of page-sized slots.
+//
+// When kalloc() finds no free page for user memory, kallocswap()
+// calls swapout() to pick a victim page with a clock (second
+// chance) policy: the clock hand sweeps over the user pages of
+// processes that uvmquiet() allows, clearing each page's accessed
+// bit, and takes the first page whose bit was already clear.
+// Its contents are written to a free slot and its PTE replaced
+// by a marker, with PTE_V clear and PTE_S set, that holds the
+// slot number where the physical address was.
+//
+// When the owner touches the page again, the page fault (or the
+// failed copyin()/copyout()) ends up in swapin(), which reads it
+// back into a new page and frees the slot.
+//
+// Only pages with a single reference are taken, so shared memory
+// and megapages stay in memory.
+//
+// One swap operation, in or out, happens at a time; swap.iolock
+// serializes them and protects the clock hand and the buffers.
+// Lock order: swap.iolock, then p->lock, then swap.lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "defs.h"
+
+#define BPP   (PGSIZE / BSIZE)         // blocks per page
+#define NSLOT (SWAPBLOCKS / BPP)
+
+// the PTE bits that a swapped-out page keeps.
+#define SWAPFLAGS (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW)
+
+// a marker PTE for slot, keeping pte's permissions.
+#define SLOT2PTE(slot, pte) \
+  (((uint64)(slot) << 10) | ((pte) & SWAPFLAGS) | PTE_S)
+#define PTE2SLOT(pte) ((int)((pte) >> 10))
+
+extern struct proc proc[NPROC];
+
+uint swapins;   // pages read back in
+uint swapouts;  // pages written out
+
+struct {
+  struct spinlock lock;
+  uint start;           // first block of the swap area
+  int nslot;            // number of slots in it
+  char used[NSLOT];     // is slot in use?
+
+  struct sleeplock iolock;
+  struct proc *hand;    // clock hand: next process to look at,
+  uint64 handva;        // and the next page in it
+  struct buf buf[BPP];  // for the blocks of one page
+} swap;
+
+// Called by fsinit() once the superblock has been read.
+void
+swapinit(int dev, struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap / BPP;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+  swap.hand = proc;
+  for(int i = 0; i < BPP; i++)
+    swap.buf[i].dev = dev;
+}
+
+static int
+slotalloc(void)
+{
+  int slot;
+
+  acquire(&swap.lock);
+  for(slot = 0; slot < swap.nslot; slot++){
+    if(!swap.used[slot]){
+      swap.used[slot] = 1;
+      release(&swap.lock);
+      return slot;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Free the slot of a marker PTE; the page in it is no longer
+// wanted. Called from uvmunmap().
+void
+swapfree(pte_t pte)
+{
+  int slot = PTE2SLOT(pte);
+
+  if((pte & (PTE_V|PTE_S)) != PTE_S || slot >= swap.nslot)
+    panic("swapfree");
+  acquire(&swap.lock);
+  if(!swap.used[slot])
+    panic("swapfree: free slot");
+  swap.used[slot] = 0;
+  release(&swap.lock);
+}
+
+// Read or write the page at mem from or to slot, with all
+// of its blocks in flight at once.
+// Caller must hold swap.iolock.
+static void
+swaprw(char *mem, int slot, int write)
+{
+  int i;
+
+  for(i = 0; i < BPP; i++){
+    struct buf *b = &swap.buf[i];
+    b->blockno = swap.start + slot*BPP + i;
+    if(write)
+      memmove(b->data, mem + i*BSIZE, BSIZE);
+    virtio_disk_start(b, write);
+  }
+  for(i = 0; i < BPP; i++){
+    struct buf *b = &swap.buf[i];
+    virtio_disk_wait(b);
+    if(!write)
+      memmove(mem + i*BSIZE, b->data, BSIZE);
+  }
+}
+
+// Look for a victim in p, starting at swap.handva, and if one
+// is found replace its PTE with a marker for slot.
+// Returns its physical address, or 0.
+// Caller must hold swap.iolock and p->lock.
+static uint64
+victim(struct proc *p, int slot)
+{
+  pte_t *pte;
+  uint64 pa = 0;
+  int level, cleared = 0;
+
+  for(; swap.handva < p->sz; swap.handva += PGSIZE){
+    level = 0;
+    if((pte = walklevel(p->pagetable, swap.handva, &level, 0)) == 0)
+      continue;
+    if(level > 0){
+      // a megapage; skip all of it.
+      swap.handva = PGROUNDDOWN(swap.handva | (MEGAPGSIZE-1));
+      continue;
+    }
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      // used since the hand last came by; give it another chance.
+      *pte &= ~PTE_A;
+      cleared = 1;
+      continue;
+    }
+    if(krefcnt((void*)PTE2PA(*pte)) != 1)
+      continue;
+    pa = PTE2PA(*pte);
+    *pte = SLOT2PTE(slot, *pte);
+    swap.handva += PGSIZE;
+    break;
+  }
+
+  // make p's TLB entries, which may still say the page is
+  // there, or that it is not accessed, go away.
+  if(pa || cleared)
+    uvmsync(p);
+  return pa;
+}
+
+// Write one user page out to swap and free its memory.
+// Returns 0, or -1 if no page can be swapped out.
+// Must not be called with any spinlock held.
+int
+swapout(void)
+{
+  struct proc *p, *me = myproc();
+  uint64 pa = 0;
+  int n, slot;
+
+  if(swap.nslot == 0 || (slot = slotalloc()) < 0)
+    return -1;
+
+  acquiresleep(&swap.iolock);
+  // go around twice: the first time may only clear
+  // accessed bits.
+  for(n = 0; n <= 2*NPROC; n++){
+    p = swap.hand;
+    if(p != me){
+      acquire(&p->lock);
+      if(uvmquiet(p))
+        pa = victim(p, slot);
+      release(&p->lock);
+      if(pa)
+        break;
+    }
+    if(++swap.hand == &proc[NPROC])
+      swap.hand = proc;
+    swap.handva = 0;
+  }
+  if(pa == 0){
+    releasesleep(&swap.iolock);
+    acquire(&swap.lock);
+    swap.used[slot] = 0;
+    release(&swap.lock);
+    return -1;
+  }
+
+  swaprw((char*)pa, slot, 1);
+  swapouts++;
+  releasesleep(&swap.iolock);
+  kfree((void*)pa);
+  return 0;
+}
+
+// Bring back the page at va in the current process's
+// page table, if it was swapped out.
+// Returns 0, or -1 if it was not swapped out or there is
+// no memory for it.
+int
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0 ||
+     (*pte & (PTE_V|PTE_S)) != PTE_S)
+    return -1;
+
+  // only this process changes its own marker PTEs,
+  // so *pte stays put while kallocswap() sleeps.
+  if((mem = kallocswap()) == 0)
+    return -1;
+  acquiresleep(&swap.iolock);
+  swaprw(mem, PTE2SLOT(*pte), 0);
+  swapins++;
+  releasesleep(&swap.iolock);
+
+  swapfree(*pte);
+  *pte = PA2PTE(mem) | (*pte & SWAPFLAGS) | PTE_V;
+  uvmsync(myproc());
+  return 0;
+}
+
+// Allocate a page for user memory, shrinking the buffer cache
+// or swapping out another process's page to make room if there
+// is none free.
+// Must not be called with any spinlock held.
+void *
+kallocswap(void)
+{
+  void *mem;
+
+  while((mem = kalloc()) == 0){
+    // cached disk blocks go before anyone's memory.
+    if(bshrink() < 0 && swapout() < 0)
+      return 0;
+  }
+  return mem;
+}
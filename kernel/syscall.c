@@ -107,6 +107,15 @@ extern uint64 sys_uptime(void);
 extern uint64 sys_pause_system(void);
 extern uint64 sys_kill_system(void);
 extern uint64 sys_print_stats(void);
+extern uint64 sys_shmget(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futexwait(void);
+extern uint64 sys_futexwake(void);
+extern uint64 sys_fsync(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -133,6 +142,15 @@ static uint64 (*syscalls[])(void) = {
 [SYS_pause_system]   sys_pause_system,
 [SYS_kill_system]   sys_kill_system,
 [SYS_print_stats]   sys_print_stats,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_spawn]   sys_spawn,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futexwait] sys_futexwait,
+[SYS_futexwake] sys_futexwake,
+[SYS_fsync]   sys_fsync,
 };
 
 void
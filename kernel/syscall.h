@@ -23,3 +23,12 @@
 #define SYS_pause_system  22
 #define SYS_kill_system  23
 #define SYS_print_stats 24
+#define SYS_shmget 25
+#define SYS_shmat  26
+#define SYS_shmdt  27
+#define SYS_spawn  28
+#define SYS_clone  29
+#define SYS_join   30
+#define SYS_futexwait 31
+#define SYS_futexwake 32
+#define SYS_fsync  33
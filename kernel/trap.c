@@ -16,6 +16,28 @@ void kernelvec();
 
 extern int devintr();
 
+// exception table, built by uaccess.S: each entry holds the
+// address of an instruction that may fault on user memory,
+// and the address to go to instead if it does.
+struct exentry {
+  uint64 insn;
+  uint64 fixup;
+};
+extern struct exentry __ex_table_start[], __ex_table_end[];
+
+// the access a user page fault with cause scause needed,
+// or 0 if scause is not a page fault.
+static int
+faultperm(uint64 scause)
+{
+  switch(scause){
+  case 12: return PTE_X;  // instruction
+  case 13: return PTE_R;  // load
+  case 15: return PTE_W;  // store
+  }
+  return 0;
+}
+
 void
 trapinit(void)
 {
@@ -65,6 +87,11 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(faultperm(r_scause()) &&
+            uvmfault(p->pagetable, r_stval(), faultperm(r_scause())) == 0){
+    // page fault on a page that was swapped out or is
+    // copy-on-write, or that another thread just mapped;
+    // it has been dealt with.
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -103,9 +130,12 @@ usertrapret(void)
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
+  // make sure p's ASIDs are current before using them.
+  int flush = asidcheck(p);
+
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_satp = kernelsatp(p);    // kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -122,14 +152,15 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // and whether to flush the TLB.
+  uint64 satp = usersatp(p);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64,uint64))fn)(TRAPFRAMEVA(p->tslot), satp, flush);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -147,6 +178,20 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+  // a page or access fault in uaccess.S: resume at its fixup.
+  if(scause == 5 || scause == 7 || scause == 13 || scause == 15){
+    for(struct exentry *e = __ex_table_start; e < __ex_table_end; e++){
+      if(e->insn == sepc){
+        w_sepc(e->fixup);
+        return;
+      }
+    }
+  }
+
+  // don't let whatever runs next touch user memory
+  // by accident; sstatus is restored below.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+
   if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -154,8 +199,11 @@ kerneltrap()
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING){
+    myproc()->kpreempted = 1;
     yield();
+    myproc()->kpreempted = 0;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -43,9 +43,10 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// this many virtio descriptors, three per request in flight.
+// must be a power of two, and small enough that the
+// descriptors and the avail ring fit in one page.
+#define NUM 128
 
 // a single descriptor, from the spec.
 struct virtq_desc {
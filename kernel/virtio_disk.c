@@ -200,8 +200,11 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// Start reading or writing b, without waiting for the disk.
+// The request is done when b->disk goes back to 0; see
+// virtio_disk_wait(). Many requests can be in flight at once.
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_start(struct buf *b, int write)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
@@ -268,20 +271,32 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  release(&disk.vdisk_lock);
+}
+
+// Wait for virtio_disk_intr() to say b's request has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
+  int done = 0;
+
   acquire(&disk.vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
@@ -305,11 +320,18 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
     b->disk = 0;   // disk is done with buf
     wakeup(b);
+    done = 1;
 
     disk.used_idx += 1;
   }
 
   release(&disk.vdisk_lock);
+
+  // a read-ahead buffer can be recycled now.
+  if(done)
+    bwakeup();
 }
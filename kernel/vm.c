@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -15,6 +17,11 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// a page of zeros, mapped copy-on-write wherever user memory
+// has not been stored to yet. The kernel keeps a reference
+// to it, so it is never freed.
+char *zeropage;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -49,11 +56,101 @@ kvmmake(void)
   return kpgtbl;
 }
 
+#ifdef KVMSTATS
+// Count the page-table pages in pagetable, a level-level
+// page, and add the level-1 leaves to *megas.
+static int
+ptpages(pagetable_t pagetable, int level, int *megas)
+{
+  int n = 1;
+
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    if((pte & PTE_V) == 0)
+      continue;
+    if(!PTE_LEAF(pte))
+      n += ptpages((pagetable_t)PTE2PA(pte), level-1, megas);
+    else if(level == 1)
+      *megas += 1;
+  }
+  return n;
+}
+
+// Report the size of the kernel page table. Without megapages,
+// each level-1 leaf would be a level-0 page instead. Times are
+// in ticks of the time CSR, which counts from reset.
+static void
+kvmstats(uint64 t0, uint64 t1)
+{
+  int megas = 0, n = ptpages(kernel_pagetable, 2, &megas);
+
+  printf("kvminit: %d page-table pages, %d without megapages\n",
+         n, n + megas);
+  printf("kvminit: built in %d ticks, %d ticks after reset\n",
+         (int)(t1 - t0), (int)t1);
+}
+#endif
+
 // Initialize the one kernel_pagetable
 void
 kvminit(void)
 {
+#ifdef KVMSTATS
+  uint64 t0 = r_time();
   kernel_pagetable = kvmmake();
+  kvmstats(t0, r_time());
+#else
+  kernel_pagetable = kvmmake();
+#endif
+  zeropage = kalloc();
+  memset(zeropage, 0, PGSIZE);
+}
+
+// Create a kernel page table for a process. It is the same as
+// kernel_pagetable, except that kvmsync() also maps the
+// process's user memory below USERTOP in it, so that copyin()
+// and copyout() can reach that memory directly. Only the top
+// page and the level-1 page for the lowest gigabyte are the
+// process's own; the rest are kernel_pagetable's.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpt, l1;
+
+  if((kpt = (pagetable_t)kalloc()) == 0)
+    return 0;
+  if((l1 = (pagetable_t)kalloc()) == 0){
+    kfree(kpt);
+    return 0;
+  }
+  memmove(kpt, kernel_pagetable, PGSIZE);
+  memmove(l1, (void*)PTE2PA(kernel_pagetable[0]), PGSIZE);
+  kpt[0] = PA2PTE(l1) | PTE_V;
+  return kpt;
+}
+
+// Make kernel page table kpt map the user memory below
+// USERTOP that user page table upt maps, by sharing upt's
+// level-0 pages and megapages. The user PTEs have PTE_U
+// set, so the kernel can use them only with sstatus.SUM.
+void
+kvmsync(pagetable_t kpt, pagetable_t upt)
+{
+  pagetable_t kl1 = (pagetable_t)PTE2PA(kpt[0]);
+  pagetable_t ul1 = 0;
+
+  if(upt[0] & PTE_V)
+    ul1 = (pagetable_t)PTE2PA(upt[0]);
+  for(int i = 0; i < PX(1, USERTOP); i++)
+    kl1[i] = ul1 ? ul1[i] : 0;
+}
+
+// Free a page table made by kvmcreate().
+void
+kvmfree(pagetable_t kpt)
+{
+  kfree((void*)PTE2PA(kpt[0]));
+  kfree((void*)kpt);
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -77,15 +174,33 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf PTE at level 1 maps a whole 2-megabyte megapage.
+// If va lies in a megapage, walk() returns its level-1 PTE.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  int level = 0;
+
+  return walklevel(pagetable, va, &level, alloc);
+}
+
+// Like walk(), but return the PTE at *level (0 or 1) rather
+// than always at level 0. If a leaf at a higher level maps
+// va, return it instead and set *level to its level.
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int *level, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -94,7 +209,7 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -105,11 +220,12 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level = 0;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, &level, 0);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
@@ -117,6 +233,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(level > 0)
+    pa += PGROUNDDOWN(va % MEGAPGSIZE);
   return pa;
 }
 
@@ -132,13 +250,17 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Wherever va and pa are both megapage-aligned,
+// a whole megapage remains, and no level-0 page-table page is
+// already there, map it with one level-1 leaf.
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, last, sz;
   pte_t *pte;
+  int level;
 
   if(size == 0)
     panic("mappages: size");
@@ -146,41 +268,95 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if(a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE){
+      level = 1;
+      sz = MEGAPGSIZE;
+    } else {
+      level = 0;
+      sz = PGSIZE;
+    }
+    if((pte = walklevel(pagetable, a, &level, 1)) == 0)
       return -1;
+    if(level == 1 && (*pte & PTE_V) && !PTE_LEAF(*pte)){
+      level = 0;
+      sz = PGSIZE;
+      if((pte = walklevel(pagetable, a, &level, 1)) == 0)
+        return -1;
+    }
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(last - a < sz)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += sz;
+    pa += sz;
   }
   return 0;
 }
 
+// Replace the megapage leaf *pte with a level-0 page-table
+// page that maps the same memory with the same permissions.
+// Returns 0 on success, -1 if out of memory.
+static int
+demote(pte_t *pte)
+{
+  pagetable_t pagetable;
+  uint64 pa = PTE2PA(*pte);
+  int i;
+
+  if((pagetable = (pagetable_t)kalloc()) == 0)
+    return -1;
+  for(i = 0; i < 512; i++)
+    pagetable[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(pagetable) | PTE_V;
+  return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
 // page-aligned. The mappings must exist.
 // Optionally free the physical memory.
+// A megapage only partly inside the range is split first.
+// A swapped-out page's swap slot is always freed.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end, n;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += n){
+    level = 0;
+    if((pte = walklevel(pagetable, a, &level, 0)) == 0)
       panic("uvmunmap: walk");
+    n = PGSIZE;
+    if((*pte & (PTE_V|PTE_S)) == PTE_S){
+      swapfree(*pte);
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
       panic("uvmunmap: not mapped");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(level == 1){
+      if(a % MEGAPGSIZE == 0 && end - a >= MEGAPGSIZE){
+        n = MEGAPGSIZE;
+      } else {
+        if(demote(pte) < 0)
+          panic("uvmunmap: demote");
+        level = 0;
+        pte = walklevel(pagetable, a, &level, 0);
+      }
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      for(uint64 off = 0; off < n; off += PGSIZE)
+        kfree((void*)(pa + off));
     }
     *pte = 0;
   }
@@ -217,25 +393,38 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Each aligned megapage of the new memory is mapped with one
+// level-1 leaf if kallocmega() can find a free block for it.
+// Other pages start out as copy-on-write mappings of zeropage,
+// and get memory of their own only when first stored to.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
   char *mem;
-  uint64 a;
+  uint64 a, n;
+  int perm;
 
   if(newsz < oldsz)
     return oldsz;
+  if(newsz > USERTOP)
+    return 0;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
-    if(mem == 0){
-      uvmdealloc(pagetable, a, oldsz);
-      return 0;
+  for(a = oldsz; a < newsz; a += n){
+    if(a % MEGAPGSIZE == 0 && newsz - a >= MEGAPGSIZE &&
+       (mem = kallocmega()) != 0){
+      n = MEGAPGSIZE;
+      memset(mem, 0, n);
+      perm = PTE_W|PTE_X|PTE_R|PTE_U;
+    } else {
+      n = PGSIZE;
+      mem = zeropage;
+      kdup(mem);
+      perm = PTE_X|PTE_R|PTE_U|PTE_COW;
     }
-    memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
-      kfree(mem);
+    if(mappages(pagetable, a, n, (uint64)mem, perm) != 0){
+      for(uint64 off = 0; off < n; off += PGSIZE)
+        kfree(mem + off);
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
@@ -262,7 +451,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 }
 
 // Recursively free page-table pages.
-// All leaf mappings must already have been removed.
+// All leaf mappings, megapages included, must already have
+// been removed.
 void
 freewalk(pagetable_t pagetable)
 {
@@ -297,26 +487,62 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // physical memory.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
+// A parent megapage stays a megapage in the child if
+// kallocmega() can find a block; otherwise it is copied
+// into ordinary pages. A swapped-out parent page is
+// swapped back in first. A copy-on-write page is not copied
+// at all; the child maps it copy-on-write too.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
+  pte_t *pte, was;
+  uint64 pa, i, n;
   uint flags;
   char *mem;
+  int level;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
+  for(i = 0; i < sz; i += n){
+    level = 0;
+    if((pte = walklevel(old, i, &level, 0)) == 0)
       panic("uvmcopy: pte should exist");
+    n = 0;
+    if((*pte & (PTE_V|PTE_S)) == PTE_S){
+      if(swapin(old, i) < 0)
+        goto err;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
       panic("uvmcopy: page not present");
+    was = *pte;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    n = PGSIZE;
+    mem = 0;
+    if(flags & PTE_COW){
+      if(mappages(new, i, n, pa, flags) != 0)
+        goto err;
+      kdup((void*)pa);
+      continue;
+    }
+    if(level == 1){
+      if(i % MEGAPGSIZE == 0 && (mem = kallocmega()) != 0)
+        n = MEGAPGSIZE;
+      else
+        pa += i % MEGAPGSIZE;
+    }
+    if(mem == 0 && (mem = kallocswap()) == 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+    if(*pte != was){
+      // swapped out or merged by ksmd while kallocswap()
+      // slept; go again.
       kfree(mem);
+      n = 0;
+      continue;
+    }
+    memmove(mem, (char*)pa, n);
+    if(mappages(new, i, n, (uint64)mem, flags) != 0){
+      for(uint64 off = 0; off < n; off += PGSIZE)
+        kfree(mem + off);
       goto err;
     }
   }
@@ -329,28 +555,162 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
+// clear PTE_W too, so that copyout()'s direct path,
+// which runs in supervisor mode, cannot write it either.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
+  int level = 0;
   
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, &level, 0);
   if(pte == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  if(level == 1){
+    if(demote(pte) < 0)
+      panic("uvmclear: demote");
+    level = 0;
+    pte = walklevel(pagetable, va, &level, 0);
+  }
+  *pte &= ~(PTE_U|PTE_W);
+}
+
+// Give pagetable its own writable copy of the copy-on-write
+// page *pte maps, or just make it writable if nothing else
+// refers to it any more.
+// Returns 0, or -1 if out of memory.
+static int
+uvmcow(pagetable_t pagetable, pte_t *pte)
+{
+  pte_t was = *pte;
+  uint64 pa = PTE2PA(*pte);
+  char *mem;
+
+  if(krefcnt((void*)pa) == 1){
+    *pte = (*pte | PTE_W) & ~PTE_COW;
+  } else {
+    if((mem = kallocswap()) == 0)
+      return -1;
+    if(*pte != was){
+      // swapped out while kallocswap() slept; go again.
+      kfree(mem);
+      return 0;
+    }
+    if((char*)pa == zeropage)
+      memset(mem, 0, PGSIZE);
+    else
+      memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+    kfree((void*)pa);
+  }
+  if(myproc() && pagetable == myproc()->pagetable)
+    uvmsync(myproc());
+  return 0;
+}
+
+// Handle a page fault at va in pagetable, for an access
+// that needs perm (PTE_R, PTE_W or PTE_X): bring the page
+// back if it was swapped out, and on a store break
+// copy-on-write.
+// Returns 0 if the access can be retried, -1 if not.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int perm)
+{
+  pte_t *pte;
+
+  va = PGROUNDDOWN(va);
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_S)) == PTE_S)
+    return swapin(pagetable, va);
+  if(perm == PTE_W && (*pte & (PTE_V|PTE_U|PTE_COW)) == (PTE_V|PTE_U|PTE_COW))
+    return uvmcow(pagetable, pte);
+  if((*pte & (PTE_V|PTE_U|perm)) == (PTE_V|PTE_U|perm)){
+    // another thread mapped the page since this cpu's
+    // TLB looked, and the TLB remembers that it was not.
+    sfence_vma();
+    return 0;
+  }
+  return -1;
+}
+
+// Like walkaddr(), but first fault va in, as for a store if
+// write is set, so that the kernel can access the page on
+// the user's behalf. Returns 0 if that is not possible.
+uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  while((pte = walk(pagetable, va, 0)) != 0 &&
+        ((*pte & PTE_V) == 0 || (write && (*pte & PTE_COW)))){
+    if(uvmfault(pagetable, va, write ? PTE_W : PTE_R) < 0)
+      return 0;
+  }
+  return walkaddr(pagetable, va);
+}
+
+// Swap in, and break copy-on-write for, every user page of
+// [start, end) in pagetable, so that it has pages of its own
+// that no one else will change the mapping of (see clone()).
+// Returns 0, or -1 if out of memory.
+int
+uvmprivate(pagetable_t pagetable, uint64 start, uint64 end)
+{
+  uint64 va;
+  pte_t *pte;
+  int level;
+
+  for(va = PGROUNDDOWN(start); va < end; va += PGSIZE){
+    level = 0;
+    if((pte = walklevel(pagetable, va, &level, 0)) == 0)
+      continue;
+    if(level > 0){
+      // megapages are never swapped or copy-on-write.
+      va = PGROUNDDOWN(va | (MEGAPGSIZE-1));
+      continue;
+    }
+    while((*pte & (PTE_V|PTE_S)) == PTE_S ||
+          (*pte & (PTE_V|PTE_U|PTE_COW)) == (PTE_V|PTE_U|PTE_COW)){
+      if(uvmfault(pagetable, va, PTE_W) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Can the kernel reach [va, va+len) of user page table
+// pagetable directly? Only if it is the current process's,
+// whose kernel page table maps its memory below USERTOP.
+static int
+direct(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  return p != 0 && pagetable == p->pagetable &&
+    va < USERTOP && len <= USERTOP - va;
 }
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
+// Memory the kernel can reach directly is copied with one
+// copyuser(); the rest, and anything copyuser() faults on,
+// a page at a time through uvmaddr(), which swaps pages back
+// in and breaks copy-on-write.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(direct(pagetable, dstva, len) && copyuser((void*)dstva, src, len) == 0)
+    return 0;
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -373,9 +733,12 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(direct(pagetable, srcva, len) && copyuser(dst, (void*)srcva, len) == 0)
+    return 0;
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -400,9 +763,22 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(max > 0 && direct(pagetable, srcva, 1)){
+    n = max;
+    if(n > USERTOP - srcva)
+      n = USERTOP - srcva;
+    switch(copyuserstr(dst, (char*)srcva, n)){
+    case 0:
+      return 0;
+    case 1:
+      if(n == max)
+        return -1;
+    }
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -0,0 +1,63 @@
+// Sequential write and read throughput of one big file, which
+// goes through the double-indirect blocks, and past 64 MB the
+// triple-indirect ones. The default disk image has room for
+// about 1 MB; make FSBLOCKS=200000 for bigger runs.
+//
+// usage: bigbench [megabytes]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define CHUNK (8*1024)
+
+char buf[CHUNK];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, mb = 1, t0, t;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb <= 0){
+    fprintf(2, "usage: bigbench [megabytes]\n");
+    exit(1);
+  }
+  n = mb * (1024*1024 / CHUNK);
+
+  if((fd = open("bigbench.tmp", O_CREATE|O_WRONLY)) < 0){
+    printf("bigbench: cannot create file\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, CHUNK) != CHUNK){
+      printf("bigbench: write failed at %d KB\n", i * (CHUNK/1024));
+      exit(1);
+    }
+  }
+  fsync(fd);
+  close(fd);
+  t = uptime() - t0;
+  printf("bigbench: wrote %d MB in %d ticks\n", mb, t);
+
+  if((fd = open("bigbench.tmp", O_RDONLY)) < 0){
+    printf("bigbench: cannot open file\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, CHUNK) != CHUNK || ((int*)buf)[0] != i){
+      printf("bigbench: bad read at %d KB\n", i * (CHUNK/1024));
+      exit(1);
+    }
+  }
+  close(fd);
+  t = uptime() - t0;
+  printf("bigbench: read %d MB in %d ticks\n", mb, t);
+
+  unlink("bigbench.tmp");
+  exit(0);
+}
@@ -0,0 +1,143 @@
+// Lock contention between threads.
+//
+// Several threads each take a lock many times to bump a shared
+// counter, with the lock being
+//   spin:  a test-and-set loop
+//   sleep: test-and-set, sleeping a tick whenever it is taken
+//   futex: a mutex from thread.c
+// Then two threads hand a turn back and forth through a mutex
+// and condition variable.
+//
+// usage: lockbench [threads [iterations]]
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+enum { SPIN, SLEEP, FUTEX };
+char *kindname[] = { "spin", "sleep", "futex" };
+
+int kind, iters;
+volatile int counter;
+int spinlk;
+struct mutex mu;
+struct cond cv;
+volatile int turn;
+
+void
+lock(void)
+{
+  switch(kind){
+  case SPIN:
+    while(__sync_lock_test_and_set(&spinlk, 1) != 0)
+      ;
+    break;
+  case SLEEP:
+    while(__sync_lock_test_and_set(&spinlk, 1) != 0)
+      sleep(1);
+    break;
+  case FUTEX:
+    mutex_lock(&mu);
+    break;
+  }
+}
+
+void
+unlock(void)
+{
+  if(kind == FUTEX)
+    mutex_unlock(&mu);
+  else
+    __sync_lock_release(&spinlk);
+}
+
+void
+worker(void *arg)
+{
+  for(int i = 0; i < iters; i++){
+    lock();
+    counter++;
+    unlock();
+  }
+  exit(0);
+}
+
+// run nt workers with locks of kind k; return the ticks taken.
+int
+contend(int k, int nt)
+{
+  int i, t0, tid[NTHREAD];
+
+  kind = k;
+  counter = 0;
+  t0 = uptime();
+  for(i = 0; i < nt; i++){
+    if((tid[i] = thread_create(worker, 0)) < 0){
+      printf("lockbench: thread_create failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < nt; i++)
+    thread_join(tid[i]);
+  if(counter != nt*iters)
+    printf("lockbench: %s lock lost updates: %d\n", kindname[k], counter);
+  return uptime() - t0;
+}
+
+// wait for turn to be me, then give it to the other.
+void
+player(void *arg)
+{
+  int me = (int)(uint64)arg;
+
+  for(int i = 0; i < iters; i++){
+    mutex_lock(&mu);
+    while(turn != me)
+      cond_wait(&cv, &mu);
+    turn = !me;
+    cond_broadcast(&cv);
+    mutex_unlock(&mu);
+  }
+  exit(0);
+}
+
+int
+pingpong(void)
+{
+  int t0, a, b;
+
+  turn = 0;
+  t0 = uptime();
+  if((a = thread_create(player, (void*)0)) < 0 ||
+     (b = thread_create(player, (void*)1)) < 0){
+    printf("lockbench: thread_create failed\n");
+    exit(1);
+  }
+  thread_join(a);
+  thread_join(b);
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nt = 4;
+
+  iters = 10000;
+  if(argc > 1)
+    nt = atoi(argv[1]);
+  if(argc > 2)
+    iters = atoi(argv[2]);
+  if(nt <= 0 || nt >= NTHREAD || iters <= 0){
+    fprintf(2, "usage: lockbench [threads (1-%d) [iterations]]\n", NTHREAD-1);
+    exit(1);
+  }
+  mutex_init(&mu);
+  cond_init(&cv);
+
+  for(int k = SPIN; k <= FUTEX; k++)
+    printf("lockbench: %d threads x %d, %s lock: %d ticks\n",
+           nt, iters, kindname[k], contend(k, nt));
+  printf("lockbench: %d condvar hand-offs: %d ticks\n", iters, pingpong());
+  exit(0);
+}
@@ -0,0 +1,125 @@
+// File system transaction latency, stressfs style.
+//
+// Several processes each append to a file of their own, one
+// block per write(), so that every write is a small transaction.
+// Then each creates and removes files, which logs a few
+// metadata blocks each time. Then each appends again, with an
+// fsync() after every write, and the slowest write+fsync is
+// reported too. Concurrent operations share commits;
+// print_stats() reports how many commits there were.
+//
+// usage: logbench [processes [operations]]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char data[1024];
+
+// append n blocks to a file; return the most ticks one took.
+int
+writer(int id, int n, int sync)
+{
+  char path[16];
+  int fd, t0, worst = 0;
+
+  snprintf(path, sizeof(path), "lb.%d", id);
+  if((fd = open(path, O_CREATE|O_WRONLY)) < 0){
+    printf("logbench: cannot create %s\n", path);
+    exit(1);
+  }
+  for(int i = 0; i < n; i++){
+    t0 = uptime();
+    if(write(fd, data, sizeof(data)) != sizeof(data) ||
+       (sync && fsync(fd) < 0)){
+      printf("logbench: write %s failed\n", path);
+      exit(1);
+    }
+    if(uptime() - t0 > worst)
+      worst = uptime() - t0;
+  }
+  close(fd);
+  unlink(path);
+  return worst;
+}
+
+int
+appender(int id, int n)
+{
+  return writer(id, n, 0);
+}
+
+int
+syncer(int id, int n)
+{
+  return writer(id, n, 1);
+}
+
+int
+creator(int id, int n)
+{
+  char path[16];
+  int fd;
+
+  for(int i = 0; i < n; i++){
+    snprintf(path, sizeof(path), "lc.%d.%d", id, i);
+    if((fd = open(path, O_CREATE|O_WRONLY)) < 0){
+      printf("logbench: cannot create %s\n", path);
+      exit(1);
+    }
+    close(fd);
+    unlink(path);
+  }
+  return 0;
+}
+
+int worst;  // the most ticks any of run()'s operations took
+
+// run np processes of f; return the ticks taken.
+int
+run(int (*f)(int, int), int np, int n)
+{
+  int i, st, t0 = uptime();
+
+  for(i = 0; i < np; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("logbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(f(i, n));
+  }
+  worst = 0;
+  for(i = 0; i < np; i++){
+    wait(&st);
+    if(st > worst)
+      worst = st;
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int np = 4, n = 100;
+
+  if(argc > 1)
+    np = atoi(argv[1]);
+  if(argc > 2)
+    n = atoi(argv[2]);
+  if(np <= 0 || n <= 0){
+    fprintf(2, "usage: logbench [processes [operations]]\n");
+    exit(1);
+  }
+  memset(data, 'l', sizeof(data));
+
+  printf("logbench: %d x %d one-block writes: %d ticks\n",
+         np, n, run(appender, np, n));
+  printf("logbench: %d x %d creates and unlinks: %d ticks\n",
+         np, n, run(creator, np, n));
+  printf("logbench: %d x %d writes with fsync: %d ticks",
+         np, n, run(syncer, np, n));
+  printf(", slowest %d\n", worst);
+  exit(0);
+}
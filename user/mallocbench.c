@@ -0,0 +1,182 @@
+// Compare malloc() and free() with the Kernighan and Ritchie
+// first-fit allocator they replaced, on workloads of many
+// small blocks.
+//
+// usage: mallocbench [iterations]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NLIVE 2000
+#define NLIST 5000
+
+// the old allocator, under other names.
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+void
+krfree(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  krfree((void*)(hp + 1));
+  return freep;
+}
+
+void*
+krmalloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+uint seed = 1;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void *live[NLIVE];
+
+// free and reallocate random slots among NLIVE live blocks
+// of 8 to 128 bytes.
+int
+churn(void *(*alloc)(uint), void (*release)(void*), int iters)
+{
+  int i, j, t0 = uptime();
+
+  seed = 1;
+  for(i = 0; i < NLIVE; i++)
+    live[i] = alloc(8 + rand() % 121);
+  for(i = 0; i < iters; i++){
+    j = rand() % NLIVE;
+    release(live[j]);
+    if((live[j] = alloc(8 + rand() % 121)) == 0){
+      fprintf(2, "mallocbench: out of memory\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < NLIVE; i++)
+    release(live[i]);
+  return uptime() - t0;
+}
+
+struct node {
+  struct node *next;
+  int val;
+};
+
+// build a list of NLIST nodes and free it, like sh's
+// parse trees, rounds times.
+int
+list(void *(*alloc)(uint), void (*release)(void*), int rounds)
+{
+  struct node *head, *n;
+  int i, r, t0 = uptime();
+
+  for(r = 0; r < rounds; r++){
+    head = 0;
+    for(i = 0; i < NLIST; i++){
+      if((n = alloc(sizeof(*n))) == 0){
+        fprintf(2, "mallocbench: out of memory\n");
+        exit(1);
+      }
+      n->val = i;
+      n->next = head;
+      head = n;
+    }
+    while(head){
+      n = head->next;
+      release(head);
+      head = n;
+    }
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100000;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: mallocbench [iterations]\n");
+    exit(1);
+  }
+
+  printf("mallocbench: churn: K&R %d ticks, malloc %d ticks\n",
+         churn(krmalloc, krfree, n), churn(malloc, free, n));
+  printf("mallocbench: list: K&R %d ticks, malloc %d ticks\n",
+         list(krmalloc, krfree, n / NLIST + 1), list(malloc, free, n / NLIST + 1));
+  exit(0);
+}
@@ -0,0 +1,95 @@
+// Pipe ping-pong latency.
+//
+// Pairs of processes bounce a byte back and forth over two
+// pipes, touching a few pages of their own memory each time,
+// so most of the time goes to switching between them. Build
+// with ASIDFLAG=NOASID to compare against flushing the TLB on
+// every return to user space.
+//
+// usage: pingpong [rounds [pairs [pages]]]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+
+char *mem;
+int npages;
+
+void
+touch(void)
+{
+  int i;
+
+  for(i = 0; i < npages; i++)
+    mem[i*PGSIZE]++;
+}
+
+// bounce a byte rounds times between
+// this process and a child.
+void
+pair(int rounds)
+{
+  int ping[2], pong[2], i;
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "pingpong: pipe failed\n");
+    exit(1);
+  }
+  if(fork() == 0){
+    for(i = 0; i < rounds; i++){
+      if(read(ping[0], &c, 1) != 1)
+        exit(1);
+      touch();
+      write(pong[1], &c, 1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < rounds; i++){
+    write(ping[1], &c, 1);
+    touch();
+    if(read(pong[0], &c, 1) != 1){
+      fprintf(2, "pingpong: lost the ball\n");
+      exit(1);
+    }
+  }
+  wait(0);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 10000, pairs = 1, i, t0, t;
+
+  npages = 16;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    pairs = atoi(argv[2]);
+  if(argc > 3)
+    npages = atoi(argv[3]);
+  if(rounds <= 0 || pairs <= 0 || npages < 0){
+    fprintf(2, "usage: pingpong [rounds [pairs [pages]]]\n");
+    exit(1);
+  }
+  if(npages > 0 && (mem = sbrk(npages*PGSIZE)) == (char*)-1){
+    fprintf(2, "pingpong: sbrk failed\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < pairs; i++){
+    if(fork() == 0)
+      pair(rounds);
+  }
+  for(i = 0; i < pairs; i++)
+    wait(0);
+  t = uptime() - t0;
+
+  // a tick is about 1/10th of a second.
+  printf("pingpong: %d pairs x %d round trips, %d pages: %d ticks, %d us per round trip\n",
+         pairs, rounds, npages, t, (int)((uint64)t * 100000 / rounds));
+  exit(0);
+}
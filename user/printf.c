@@ -1,19 +1,83 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
 #include "user/user.h"
 
 #include <stdarg.h>
 
+// Output is buffered per file descriptor. Output to the console
+// is written at each newline and at the end of each call, other
+// output when its buffer fills. ulib.c flushes the buffers
+// before exit(), fork() and exec(), and a descriptor's buffer
+// before close() of it, through stdioflush.
+
+#define BUFSZ 512
+
+enum { UNKNOWN, CONSOLE, OTHER };
+
+static struct {
+  int kind;         // what the fd refers to, if known
+  int n;            // bytes buffered
+  char buf[BUFSZ];
+} obuf[NOFILE];
+
+// where formatted output goes: an fd's buffer, or a string.
+struct out {
+  int fd;           // -1 when formatting into str
+  char *str;
+  int max;          // size of str
+  int len;          // characters produced so far
+};
+
 static char digits[] = "0123456789ABCDEF";
 
+// write out fd's buffer.
+int
+fflush(int fd)
+{
+  int n;
+
+  if(fd < 0 || fd >= NOFILE || obuf[fd].n == 0)
+    return 0;
+  n = obuf[fd].n;
+  obuf[fd].n = 0;
+  return write(fd, obuf[fd].buf, n) == n ? 0 : -1;
+}
+
+// flush fd's buffer and forget what fd refers to,
+// or flush all buffers if fd is -1.
 static void
-putc(int fd, char c)
+flush(int fd)
 {
-  write(fd, &c, 1);
+  if(fd >= 0 && fd < NOFILE){
+    fflush(fd);
+    obuf[fd].kind = UNKNOWN;
+    return;
+  }
+  for(fd = 0; fd < NOFILE; fd++)
+    fflush(fd);
+}
+
+static void
+putc(struct out *o, char c)
+{
+  o->len++;
+  if(o->fd < 0){
+    if(o->len < o->max)
+      o->str[o->len - 1] = c;
+    return;
+  }
+  if(o->fd >= NOFILE){
+    write(o->fd, &c, 1);
+    return;
+  }
+  obuf[o->fd].buf[obuf[o->fd].n++] = c;
+  if(obuf[o->fd].n == BUFSZ || (c == '\n' && obuf[o->fd].kind == CONSOLE))
+    fflush(o->fd);
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct out *o, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,21 +99,21 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(o, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(struct out *o, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(o, '0');
+  putc(o, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(o, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
-void
-vprintf(int fd, const char *fmt, va_list ap)
+// Format into o. Only understands %d, %x, %p, %s.
+static void
+format(struct out *o, const char *fmt, va_list ap)
 {
   char *s;
   int c, i, state;
@@ -61,39 +125,65 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(o, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(o, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(o, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(o, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(o, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(o, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(o, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(o, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(o, '%');
+        putc(o, c);
       }
       state = 0;
     }
   }
 }
 
+// Print to the given fd.
+void
+vprintf(int fd, const char *fmt, va_list ap)
+{
+  struct out o;
+  struct stat st;
+
+  if(fd < 0)
+    return;
+  if(fd < NOFILE && obuf[fd].kind == UNKNOWN){
+    // an fd that can't be fstat()ed is written at once,
+    // so that errors show up as they did before.
+    if(fstat(fd, &st) < 0 || st.type == T_DEVICE)
+      obuf[fd].kind = CONSOLE;
+    else
+      obuf[fd].kind = OTHER;
+    stdioflush = flush;
+  }
+
+  o.fd = fd;
+  o.len = 0;
+  format(&o, fmt, ap);
+  if(fd < NOFILE && obuf[fd].kind == CONSOLE)
+    fflush(fd);
+}
+
 void
 fprintf(int fd, const char *fmt, ...)
 {
@@ -111,3 +201,23 @@ printf(const char *fmt, ...)
   va_start(ap, fmt);
   vprintf(1, fmt, ap);
 }
+
+// Format into buf, which holds n bytes, always null-terminating
+// it if n > 0. Returns the length of the whole formatted string,
+// which is n or more if it did not fit.
+int
+snprintf(char *buf, int n, const char *fmt, ...)
+{
+  va_list ap;
+  struct out o;
+
+  o.fd = -1;
+  o.str = buf;
+  o.max = n;
+  o.len = 0;
+  va_start(ap, fmt);
+  format(&o, fmt, ap);
+  if(n > 0)
+    buf[o.len < n ? o.len : n - 1] = 0;
+  return o.len;
+}
@@ -0,0 +1,104 @@
+// File read throughput, to see how well the buffer cache holds
+// a working set.
+//
+// Sequential: read one file of FILEKB kilobytes from start to
+// end, several times. Random: read NSMALL two-block files in a
+// pseudo-random order (there is no lseek()). Each test's first
+// pass is cold, unless the cache kept the blocks since they were
+// written; the rest are warm if the cache is big enough.
+//
+// usage: readbench [passes]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define FILEKB 200
+#define NSMALL 100
+#define SMALLSZ 2048
+
+char buf[1024];
+
+void
+writefile(char *name, int n)
+{
+  int fd;
+
+  if((fd = open(name, O_CREATE|O_WRONLY)) < 0){
+    printf("readbench: cannot create %s\n", name);
+    exit(1);
+  }
+  for(; n > 0; n -= sizeof(buf)){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("readbench: write %s failed\n", name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+void
+readfile(char *name)
+{
+  int fd;
+
+  if((fd = open(name, O_RDONLY)) < 0){
+    printf("readbench: cannot open %s\n", name);
+    exit(1);
+  }
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+}
+
+void
+smallname(char *name, int i)
+{
+  snprintf(name, 16, "rb.%d", i);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, pass, passes = 4, t0;
+  uint seed = 1;
+  char name[16];
+
+  if(argc > 1)
+    passes = atoi(argv[1]);
+  if(passes <= 0){
+    fprintf(2, "usage: readbench [passes]\n");
+    exit(1);
+  }
+
+  memset(buf, 'r', sizeof(buf));
+  writefile("rb.big", FILEKB*1024);
+  for(i = 0; i < NSMALL; i++){
+    smallname(name, i);
+    writefile(name, SMALLSZ);
+  }
+
+  for(pass = 0; pass < passes; pass++){
+    t0 = uptime();
+    readfile("rb.big");
+    printf("readbench: sequential %d KB, pass %d: %d ticks\n",
+           FILEKB, pass, uptime() - t0);
+  }
+  for(pass = 0; pass < passes; pass++){
+    t0 = uptime();
+    for(i = 0; i < NSMALL; i++){
+      seed = seed * 1103515245 + 12345;
+      smallname(name, (seed >> 16) % NSMALL);
+      readfile(name);
+    }
+    printf("readbench: random %d files, pass %d: %d ticks\n",
+           NSMALL, pass, uptime() - t0);
+  }
+
+  unlink("rb.big");
+  for(i = 0; i < NSMALL; i++){
+    smallname(name, i);
+    unlink(name);
+  }
+  exit(0);
+}
@@ -0,0 +1,131 @@
+// Producer/consumer throughput: pipe vs. shared memory.
+//
+// A child produces a stream of bytes and the parent consumes it,
+// first through a pipe, then through a double-buffered shared
+// memory segment where only one-byte tokens go through pipes.
+//
+// usage: shmbench [megabytes]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define CHUNK 4096
+#define HALF  (32*1024)
+
+char buf[CHUNK];
+uint sink;  // keeps the consumer's work from being optimized away
+
+// fill a buffer the way the producer does.
+void
+produce(char *p, int n, int seq)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    p[i] = seq + i;
+}
+
+// what the consumer does with each buffer.
+uint
+consume(char *p, int n)
+{
+  uint sum = 0;
+  int i;
+
+  for(i = 0; i < n; i++)
+    sum += (uchar)p[i];
+  return sum;
+}
+
+int
+viapipe(int total)
+{
+  int fds[2], n, got, t0;
+
+  if(pipe(fds) < 0){
+    printf("shmbench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  if(fork() == 0){
+    close(fds[0]);
+    for(n = 0; n < total; n += CHUNK){
+      produce(buf, CHUNK, n);
+      if(write(fds[1], buf, CHUNK) != CHUNK)
+        exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  got = 0;
+  while((n = read(fds[0], buf, CHUNK)) > 0){
+    sink += consume(buf, n);
+    got += n;
+  }
+  close(fds[0]);
+  wait(0);
+  if(got != total)
+    printf("shmbench: pipe lost data\n");
+  return uptime() - t0;
+}
+
+int
+viashm(int total)
+{
+  int full[2], empty[2], id, n, t0, half;
+  char *seg, tok = 0;
+
+  if((id = shmget(0, 2*HALF)) < 0 || (seg = shmat(id)) == (char*)-1){
+    printf("shmbench: cannot set up shared memory\n");
+    exit(1);
+  }
+  if(pipe(full) < 0 || pipe(empty) < 0){
+    printf("shmbench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  if(fork() == 0){
+    // both halves start out empty.
+    write(empty[1], &tok, 1);
+    write(empty[1], &tok, 1);
+    for(n = 0, half = 0; n < total; n += HALF, half ^= 1){
+      if(read(empty[0], &tok, 1) != 1)
+        exit(1);
+      produce(seg + half*HALF, HALF, n);
+      write(full[1], &tok, 1);
+    }
+    exit(0);
+  }
+  for(n = 0, half = 0; n < total; n += HALF, half ^= 1){
+    if(read(full[0], &tok, 1) != 1)
+      break;
+    sink += consume(seg + half*HALF, HALF);
+    write(empty[1], &tok, 1);
+  }
+  wait(0);
+  close(full[0]);
+  close(full[1]);
+  close(empty[0]);
+  close(empty[1]);
+  shmdt(seg);
+  if(n < total)
+    printf("shmbench: shm lost data\n");
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 4;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb <= 0){
+    fprintf(2, "usage: shmbench [megabytes]\n");
+    exit(1);
+  }
+
+  printf("shmbench: %d MB, pipe: %d ticks\n", mb, viapipe(mb*1024*1024));
+  printf("shmbench: %d MB, shm:  %d ticks\n", mb, viashm(mb*1024*1024));
+  exit(0);
+}
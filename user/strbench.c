@@ -0,0 +1,138 @@
+// Compare ulib's string and memory routines with the
+// byte-at-a-time loops they replaced.
+//
+// usage: strbench [iterations]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define BUFSZ 4096
+#define STRSZ 1000
+
+char a[BUFSZ], b[BUFSZ];
+uint sink;  // keeps results from being optimized away
+
+void*
+bytememset(void *dst, int c, uint n)
+{
+  char *cdst = (char *) dst;
+  int i;
+  for(i = 0; i < n; i++){
+    cdst[i] = c;
+  }
+  return dst;
+}
+
+void*
+bytememmove(void *vdst, const void *vsrc, int n)
+{
+  char *dst;
+  const char *src;
+
+  dst = vdst;
+  src = vsrc;
+  if (src > dst) {
+    while(n-- > 0)
+      *dst++ = *src++;
+  } else {
+    dst += n;
+    src += n;
+    while(n-- > 0)
+      *--dst = *--src;
+  }
+  return vdst;
+}
+
+uint
+bytestrlen(const char *s)
+{
+  int n;
+
+  for(n = 0; s[n]; n++)
+    ;
+  return n;
+}
+
+char*
+bytestrchr(const char *s, char c)
+{
+  for(; *s; s++)
+    if(*s == c)
+      return (char*)s;
+  return 0;
+}
+
+int
+bytestrcmp(const char *p, const char *q)
+{
+  while(*p && *p == *q)
+    p++, q++;
+  return (uchar)*p - (uchar)*q;
+}
+
+void
+report(char *what, int old, int new)
+{
+  printf("strbench: %s: byte loop %d ticks, ulib %d ticks\n", what, old, new);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 20000, i, t0, t1;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: strbench [iterations]\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    bytememset(a, i, BUFSZ);
+  t1 = uptime();
+  for(i = 0; i < n; i++)
+    memset(a, i, BUFSZ);
+  report("memset 4096", t1 - t0, uptime() - t1);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    bytememmove(b, a, BUFSZ);
+  t1 = uptime();
+  for(i = 0; i < n; i++)
+    memmove(b, a, BUFSZ);
+  report("memmove 4096", t1 - t0, uptime() - t1);
+
+  // a string, and an equal copy of it, with no 'x' in it.
+  for(i = 0; i < STRSZ; i++)
+    a[i] = 'a' + i % 23;
+  a[STRSZ] = 0;
+  memmove(b, a, STRSZ + 1);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    sink += bytestrlen(a);
+  t1 = uptime();
+  for(i = 0; i < n; i++)
+    sink += strlen(a);
+  report("strlen 1000", t1 - t0, uptime() - t1);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    sink += bytestrchr(a, 'x') != 0;
+  t1 = uptime();
+  for(i = 0; i < n; i++)
+    sink += strchr(a, 'x') != 0;
+  report("strchr 1000", t1 - t0, uptime() - t1);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    sink += bytestrcmp(a, b);
+  t1 = uptime();
+  for(i = 0; i < n; i++)
+    sink += strcmp(a, b);
+  report("strcmp 1000", t1 - t0, uptime() - t1);
+
+  exit(0);
+}
@@ -0,0 +1,144 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+// Threads, on top of clone() and join(). Each thread gets a
+// stack of TSTACK bytes from malloc(), which thread_join()
+// frees. Like malloc(), these must not be called by two
+// threads at once. Nor is printf()'s buffering locked, so a
+// thread leaves through _exit(), not exit(), which would flush
+// the buffers that the other threads may be filling. Output a
+// thread leaves buffered goes out with the next flush.
+//
+// Mutexes and condition variables, on top of futexwait() and
+// futexwake(). They only enter the kernel to wait, or to wake
+// a thread that may be waiting.
+
+#define TSTACK (4*4096)
+
+static struct thread {
+  int tid;
+  char *stack;        // 0 if this entry is free
+  void (*fn)(void*);
+  void *arg;
+} threads[NTHREAD];
+
+static void
+start(void *a)
+{
+  struct thread *t = a;
+
+  t->fn(t->arg);
+  _exit(0);  // not exit(); see above
+}
+
+// Start a thread that runs fn(arg) and then exits.
+// Returns its id, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct thread *t;
+
+  for(t = threads; t < &threads[NTHREAD]; t++){
+    if(t->stack == 0)
+      goto found;
+  }
+  return -1;
+
+found:
+  if((t->stack = malloc(TSTACK)) == 0)
+    return -1;
+  t->fn = fn;
+  t->arg = arg;
+  if((t->tid = clone(start, t, t->stack + TSTACK)) < 0){
+    free(t->stack);
+    t->stack = 0;
+    return -1;
+  }
+  return t->tid;
+}
+
+// Wait for thread tid to exit, and free its stack.
+// Returns 0, or -1 if there is no such thread.
+int
+thread_join(int tid)
+{
+  struct thread *t;
+
+  for(t = threads; t < &threads[NTHREAD]; t++){
+    if(t->stack && t->tid == tid)
+      goto found;
+  }
+  return -1;
+
+found:
+  if(join(tid, 0) < 0)
+    return -1;
+  free(t->stack);
+  t->stack = 0;
+  return 0;
+}
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // contended: say there is a waiter, and wait until
+  // we are the one to change it from unlocked.
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futexwait(&m->state, 2);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+    futexwake(&m->state, 1);
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, wait for a signal, and take m again. As with
+// any condition variable, the caller must recheck what it is
+// waiting for, since other threads may get there first.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+
+  mutex_unlock(m);
+  // returns at once if a signal came since seq was read.
+  futexwait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futexwake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futexwake(&c->seq, NTHREAD);
+}
@@ -3,6 +3,66 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// The string and memory routines work a 64-bit word at a time
+// once their pointers are word-aligned. Aligned loads never
+// cross a page boundary, so reading a whole word that holds
+// the end of a string is safe.
+//
+// HASZERO(w) is non-zero iff some byte of w is zero: that
+// byte's subtraction borrows, setting its top bit, which
+// ~w keeps only if the byte's top bit was clear.
+
+#define WSIZE sizeof(uint64)
+#define ALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+#define ONES  0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+#define HASZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
+// printf.c sets stdioflush once it has buffered output.
+// stdioflush(fd) writes out fd's buffer; stdioflush(-1)
+// writes out all of them.
+void (*stdioflush)(int);
+
+int
+fork(void)
+{
+  if(stdioflush)
+    stdioflush(-1);
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  if(stdioflush)
+    stdioflush(-1);
+  _exit(status);
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(stdioflush)
+    stdioflush(-1);
+  return _exec(path, argv);
+}
+
+int
+spawn(char *path, char **argv, int *fds)
+{
+  if(stdioflush)
+    stdioflush(-1);
+  return _spawn(path, argv, fds);
+}
+
+int
+close(int fd)
+{
+  if(stdioflush)
+    stdioflush(fd);
+  return _close(fd);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -17,6 +77,20 @@ strcpy(char *s, const char *t)
 int
 strcmp(const char *p, const char *q)
 {
+  const uint64 *wp, *wq;
+
+  if(((uint64)p & (WSIZE-1)) == ((uint64)q & (WSIZE-1))){
+    for(; !ALIGNED(p); p++, q++)
+      if(*p == 0 || *p != *q)
+        return (uchar)*p - (uchar)*q;
+    // skip whole words that are equal and hold no null.
+    wp = (const uint64*)p;
+    wq = (const uint64*)q;
+    while(*wp == *wq && !HASZERO(*wp))
+      wp++, wq++;
+    p = (const char*)wp;
+    q = (const char*)wq;
+  }
   while(*p && *p == *q)
     p++, q++;
   return (uchar)*p - (uchar)*q;
@@ -25,28 +99,57 @@ strcmp(const char *p, const char *q)
 uint
 strlen(const char *s)
 {
-  int n;
+  const char *p = s;
+  const uint64 *w;
 
-  for(n = 0; s[n]; n++)
+  for(; !ALIGNED(p); p++)
+    if(*p == 0)
+      return p - s;
+  for(w = (const uint64*)p; !HASZERO(*w); w++)
     ;
-  return n;
+  for(p = (const char*)w; *p; p++)
+    ;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 *w, word;
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+  word = (uchar)c * ONES;
+  for(w = (uint64*)cdst; n >= 4*WSIZE; n -= 4*WSIZE, w += 4){
+    w[0] = word;
+    w[1] = word;
+    w[2] = word;
+    w[3] = word;
   }
+  for(; n >= WSIZE; n -= WSIZE)
+    *w++ = word;
+  for(cdst = (char*)w; n > 0; n--)
+    *cdst++ = c;
   return dst;
 }
 
 char*
 strchr(const char *s, char c)
 {
-  for(; *s; s++)
+  const uint64 *w;
+  uint64 pat = (uchar)c * ONES;
+
+  for(; !ALIGNED(s); s++){
+    if(*s == 0)
+      return 0;
+    if(*s == c)
+      return (char*)s;
+  }
+  // skip words that hold neither c nor a null.
+  for(w = (const uint64*)s; !HASZERO(*w) && !HASZERO(*w ^ pat); w++)
+    ;
+  for(s = (const char*)w; *s; s++)
     if(*s == c)
       return (char*)s;
   return 0;
@@ -100,15 +203,47 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  uint64 *wd;
+  const uint64 *ws;
+  int samealign;
 
+  if(n <= 0)
+    return vdst;  // the word loops compare n as unsigned
   dst = vdst;
   src = vsrc;
+  samealign = ((uint64)src & (WSIZE-1)) == ((uint64)dst & (WSIZE-1));
   if (src > dst) {
+    if(samealign){
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *dst++ = *src++;
+      wd = (uint64*)dst;
+      ws = (const uint64*)src;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, wd += 4, ws += 4){
+        wd[0] = ws[0];
+        wd[1] = ws[1];
+        wd[2] = ws[2];
+        wd[3] = ws[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      dst = (char*)wd;
+      src = (const char*)ws;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(samealign){
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *--dst = *--src;
+      wd = (uint64*)dst;
+      ws = (const uint64*)src;
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      dst = (char*)wd;
+      src = (const char*)ws;
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -119,6 +254,16 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+
+  // skip equal words; compare the first unequal one bytewise.
+  if(((uint64)p1 & (WSIZE-1)) == ((uint64)p2 & (WSIZE-1))){
+    for(; n > 0 && !ALIGNED(p1) && *p1 == *p2; n--)
+      p1++, p2++;
+    if(ALIGNED(p1)){
+      for(; n >= WSIZE && *(const uint64*)p1 == *(const uint64*)p2; n -= WSIZE)
+        p1 += WSIZE, p2 += WSIZE;
+    }
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
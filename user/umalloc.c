@@ -3,8 +3,20 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small blocks, up to MAXSMALL bytes including the header, are
+// rounded up to a power-of-two size class. Each class has its
+// own free list, so malloc() and free() of a small block take
+// constant time. An empty class list is refilled by cutting up
+// a page from a pool that grows POOLPAGES pages at a time.
+//
+// Larger blocks come from the first-fit free list of Kernighan
+// and Ritchie, The C Programming Language, 2nd ed., Section
+// 8.7, which merges neighbouring free blocks.
+//
+// Every block starts with a Header whose s.size is the block's
+// size in Header units, which tells free() where it belongs.
 
 typedef long Align;
 
@@ -18,15 +30,24 @@ union header {
 
 typedef union header Header;
 
+#define PAGE      4096
+#define POOLPAGES 16
+#define NCLASS    8                               // 32, 64, ..., 4096 bytes
+#define MINSMALL  32
+#define MAXSMALL  (MINSMALL << (NCLASS-1))
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+static Header *classfree[NCLASS];
+static char *pool, *poolend;
+
+// free a large block.
+static void
+bigfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -56,12 +77,12 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  bigfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+bigmalloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
@@ -88,3 +109,75 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// size class of a block of n bytes, header included.
+static int
+sizeclass(uint n)
+{
+  int c;
+
+  for(c = 0; (MINSMALL << c) < n; c++)
+    ;
+  return c;
+}
+
+// cut a page from the pool into blocks of class c.
+static int
+refill(int c)
+{
+  uint sz = MINSMALL << c;
+  char *p;
+  Header *h;
+
+  if(pool == poolend){
+    if((p = sbrk(POOLPAGES * PAGE)) != (char*)-1)
+      poolend = p + POOLPAGES * PAGE;
+    else if((p = sbrk(PAGE)) != (char*)-1)
+      poolend = p + PAGE;
+    else
+      return -1;
+    pool = p;
+  }
+  for(p = pool; p < pool + PAGE; p += sz){
+    h = (Header*)p;
+    h->s.size = sz / sizeof(Header);
+    h->s.ptr = classfree[c];
+    classfree[c] = h;
+  }
+  pool += PAGE;
+  return 0;
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+  int c;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.size > MAXSMALL / sizeof(Header)){
+    bigfree(bp);
+    return;
+  }
+  c = sizeclass(bp->s.size * sizeof(Header));
+  bp->s.ptr = classfree[c];
+  classfree[c] = bp;
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *h;
+  int c;
+
+  if(nbytes > MAXSMALL - sizeof(Header))
+    return bigmalloc(nbytes);
+  c = sizeclass(nbytes + sizeof(Header));
+  if(classfree[c] == 0 && refill(c) < 0)
+    return 0;
+  h = classfree[c];
+  classfree[c] = h->s.ptr;
+  return (void*)(h + 1);
+}
@@ -26,6 +26,23 @@ int uptime(void);
 int pause_system(int);
 int kill_system(void);
 int print_stats(void);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+int spawn(char*, char**, int*);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futexwait(int*, int);
+int futexwake(int*, int);
+int fsync(int);
+
+// the same system calls as fork, exit, close, exec and spawn,
+// without first flushing printf's buffers.
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _close(int);
+int _exec(char*, char**);
+int _spawn(char*, char**, int*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -35,6 +52,8 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
+int snprintf(char*, int, const char*, ...);
+int fflush(int);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
@@ -43,3 +62,21 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+extern void (*stdioflush)(int);
+
+// thread.c
+struct mutex {
+  int state;  // 0: unlocked, 1: locked, 2: locked and maybe waited for
+};
+struct cond {
+  int seq;    // bumped by each signal
+};
+int thread_create(void (*)(void*), void*);
+int thread_join(int);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
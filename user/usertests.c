@@ -569,9 +569,11 @@ writetest(char *s)
   }
 }
 
+// a file that goes into the double-indirect blocks.
 void
 writebig(char *s)
 {
+  enum { NBIG = NDIRECT + NINDIRECT + 300 };
   int i, fd, n;
 
   fd = open("big", O_CREATE|O_RDWR);
@@ -580,7 +582,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -600,7 +602,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -724,6 +726,228 @@ exectest(char *s)
 
 }
 
+// spawn a child with its output redirected to a pipe.
+// it must get no other fds, or the read would never see EOF.
+void
+spawntest(char *s)
+{
+  int fds[2], cfds[3], n, tot, pid, xstatus;
+  char *echoargv[] = { "echo", "spawned", "OK", 0 };
+  char buf[32];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  cfds[0] = -1;
+  cfds[1] = fds[1];
+  cfds[2] = 2;
+  if((pid = spawn("echo", echoargv, cfds)) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf + tot, sizeof(buf) - 1 - tot)) > 0)
+    tot += n;
+  close(fds[0]);
+  buf[tot] = 0;
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  if(strcmp(buf, "spawned OK\n") != 0){
+    printf("%s: wrong output %s\n", s, buf);
+    exit(1);
+  }
+
+  cfds[1] = NOFILE;
+  if(spawn("echo", echoargv, cfds) >= 0){
+    printf("%s: spawn with a bad fd succeeded\n", s);
+    exit(1);
+  }
+  if(spawn("nonexistent", echoargv, 0) >= 0){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+}
+
+// threads made by clone() share memory and open files, and
+// can grow memory that all of them see.
+
+#define NTHR 4
+static volatile int thrcount[NTHR];
+static char * volatile thrmem[NTHR];
+static volatile int thrfd = -1;
+
+static void
+threadfn(void *arg)
+{
+  int i = (int)(uint64)arg;
+  char *p;
+
+  for(int j = 0; j < 100000; j++)
+    thrcount[i]++;
+  if((p = sbrk(PGSIZE)) == (char*)-1)
+    exit(1);
+  p[0] = p[PGSIZE-1] = 'a' + i;
+  thrmem[i] = p;
+  if(i == 0)
+    thrfd = open("threadfile", O_CREATE|O_RDWR);
+  exit(0);
+}
+
+void
+threadtest(char *s)
+{
+  int i, tid[NTHR];
+  char c;
+
+  for(i = 0; i < NTHR; i++){
+    if((tid[i] = thread_create(threadfn, (void*)(uint64)i)) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NTHR; i++){
+    if(thread_join(tid[i]) < 0){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NTHR; i++){
+    if(thrcount[i] != 100000 || thrmem[i] == 0 ||
+       thrmem[i][0] != 'a' + i || thrmem[i][PGSIZE-1] != 'a' + i){
+      printf("%s: thread %d's work is missing\n", s, i);
+      exit(1);
+    }
+  }
+  if(thread_join(tid[0]) >= 0 || wait(0) >= 0){
+    printf("%s: joined or waited for a thread twice\n", s);
+    exit(1);
+  }
+
+  // the file thread 0 opened is open here too.
+  if(thrfd < 0 || write(thrfd, "t", 1) != 1){
+    printf("%s: thread's file not shared\n", s);
+    exit(1);
+  }
+  close(thrfd);
+  i = open("threadfile", O_RDONLY);
+  if(i < 0 || read(i, &c, 1) != 1 || c != 't'){
+    printf("%s: wrong file contents\n", s);
+    exit(1);
+  }
+  close(i);
+  unlink("threadfile");
+}
+
+// a futex mutex keeps threads' updates from being lost, and
+// futexwait() does not sleep if the value has changed.
+
+static struct mutex futexmu;
+static volatile int futexcount;
+
+static void
+futexfn(void *arg)
+{
+  for(int i = 0; i < 10000; i++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+  exit(0);
+}
+
+void
+futextest(char *s)
+{
+  int i, tid[NTHR], word = 1;
+
+  if(futexwait(&word, 0) != -1){
+    printf("%s: futexwait slept on a changed value\n", s);
+    exit(1);
+  }
+  if(futexwake(&word, 1) != 0){
+    printf("%s: futexwake woke a thread that was not waiting\n", s);
+    exit(1);
+  }
+
+  mutex_init(&futexmu);
+  for(i = 0; i < NTHR; i++){
+    if((tid[i] = thread_create(futexfn, 0)) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NTHR; i++)
+    thread_join(tid[i]);
+  if(futexcount != NTHR*10000){
+    printf("%s: lost updates: %d\n", s, futexcount);
+    exit(1);
+  }
+}
+
+// several processes writing and fsync()ing at once.
+void
+fsynctest(char *s)
+{
+  enum { N=4, NW=20 };
+  int fd, i, pid, xstatus;
+  char name[16];
+
+  if(fsync(-1) != -1){
+    printf("%s: fsync of a bad fd succeeded\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if((pid = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      snprintf(name, sizeof(name), "fsync%d", i);
+      if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+        printf("%s: create %s failed\n", s, name);
+        exit(1);
+      }
+      memset(buf, 'a'+i, BSIZE);
+      for(int j = 0; j < NW; j++){
+        if(write(fd, buf, BSIZE) != BSIZE || fsync(fd) != 0){
+          printf("%s: write or fsync failed\n", s);
+          exit(1);
+        }
+      }
+      close(fd);
+      exit(0);
+    }
+  }
+  for(i = 0; i < N; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  for(i = 0; i < N; i++){
+    snprintf(name, sizeof(name), "fsync%d", i);
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    for(int j = 0; j < NW; j++){
+      if(read(fd, buf, BSIZE) != BSIZE || buf[0] != 'a'+i || buf[BSIZE-1] != 'a'+i){
+        printf("%s: %s has the wrong contents\n", s, name);
+        exit(1);
+      }
+    }
+    if(read(fd, buf, BSIZE) != 0){
+      printf("%s: %s too long\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    unlink(name);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -779,6 +1003,59 @@ pipe1(char *s)
   }
 }
 
+// a child writes into a shared memory segment it inherited
+// across fork, and the parent sees the data.
+void
+shmtest(char *s)
+{
+  enum { SZ=3*4096 };
+  int id, pid, xstatus, i;
+  char *a;
+
+  if((id = shmget(0, SZ)) < 0){
+    printf("%s: shmget failed\n", s);
+    exit(1);
+  }
+  if((a = shmat(id)) == (char*)-1){
+    printf("%s: shmat failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(a[i] != 0){
+      printf("%s: new segment not zeroed\n", s);
+      exit(1);
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < SZ; i++)
+      a[i] = i % 251;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(i = 0; i < SZ; i++){
+    if(a[i] != i % 251){
+      printf("%s: parent does not see child's write\n", s);
+      exit(1);
+    }
+  }
+
+  if(shmdt(a) != 0){
+    printf("%s: shmdt failed\n", s);
+    exit(1);
+  }
+  if(shmdt(a) == 0){
+    printf("%s: shmdt of detached segment succeeded\n", s);
+    exit(1);
+  }
+}
 
 // test if child is killed (status = -1)
 void
@@ -2204,6 +2481,212 @@ sbrkmuch(char *s)
   }
 }
 
+// user memory mapped with 2-megabyte megapages must behave
+// like ordinary pages across fork, pipes, and partial sbrk.
+void
+megapages(char *s)
+{
+  enum { MEG2=2*1024*1024, N=3*MEG2 };
+  char *oldbrk, *a, *p;
+  int fds[2], pid, xstatus;
+  char buf[8];
+
+  oldbrk = sbrk(0);
+  // start the new memory on a megapage boundary.
+  sbrk(MEG2 - ((uint64)oldbrk % MEG2));
+  a = sbrk(N);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + N; p += PGSIZE)
+    *p = (p - a) / PGSIZE;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + N; p += PGSIZE){
+      if(*p != (char)((p - a) / PGSIZE)){
+        printf("%s: child sees wrong data\n", s);
+        exit(1);
+      }
+      *p = ~*p;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(p = a; p < a + N; p += PGSIZE){
+    if(*p != (char)((p - a) / PGSIZE)){
+      printf("%s: child write visible in parent\n", s);
+      exit(1);
+    }
+  }
+
+  // copyout into the middle of a megapage.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "megapage", 8);
+  if(read(fds[0], a + MEG2 + 5000, 8) != 8 || memcmp(a + MEG2 + 5000, "megapage", 8) != 0){
+    printf("%s: read into megapage failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // shrink to the middle of the last megapage, which splits it.
+  sbrk(-(MEG2 / 2));
+  for(p = a; p < a + N - MEG2/2; p += PGSIZE){
+    if(*p != (char)((p - a) / PGSIZE)){
+      printf("%s: data lost by shrink\n", s);
+      exit(1);
+    }
+  }
+  memmove(buf, a + MEG2 + 5000, 8);
+  if(memcmp(buf, "megapage", 8) != 0){
+    printf("%s: data lost by shrink\n", s);
+    exit(1);
+  }
+
+  sbrk(-(sbrk(0) - oldbrk));
+}
+
+// fresh sbrk memory shares the kernel's zero page until it is
+// stored to, by the process itself, by a fork child, or by
+// the kernel on the process's behalf.
+void
+zeropage(char *s)
+{
+  enum { N=64 };
+  char *a, *p;
+  int fds[2], pid, xstatus;
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + N*PGSIZE; p += 64){
+    if(*p != 0){
+      printf("%s: new memory not zero\n", s);
+      exit(1);
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + N*PGSIZE; p += 2*PGSIZE)
+      *p = 1;
+    for(p = a; p < a + N*PGSIZE; p += PGSIZE){
+      if(*p != ((p - a) / PGSIZE % 2 == 0)){
+        printf("%s: child sees wrong data\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(p = a; p < a + N*PGSIZE; p += PGSIZE){
+    if(*p != 0){
+      printf("%s: child store visible in parent\n", s);
+      exit(1);
+    }
+  }
+
+  // copyout into an untouched page.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "zero", 4);
+  if(read(fds[0], a + 5*PGSIZE + 100, 4) != 4 || memcmp(a + 5*PGSIZE + 100, "zero", 4) != 0){
+    printf("%s: read into zero page failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(a[6*PGSIZE + 100] != 0){
+    printf("%s: store went to the zero page\n", s);
+    exit(1);
+  }
+
+  sbrk(-N*PGSIZE);
+}
+
+int countfree();
+
+// read from a pipe into new, untouched memory while a hog
+// holds nearly all of memory and swap, so that the copyout()
+// of each read must take a page for the copy on write, and
+// swap another out for it.
+void
+pipezero(char *s)
+{
+  enum { N=32, SPARE=128 };
+  char *a, *p, buf[512], c;
+  int fds[2], ready[2], hog, avail, i, j;
+
+  avail = countfree();
+  if(pipe(fds) < 0 || pipe(ready) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  hog = fork();
+  if(hog < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(hog == 0){
+    for(i = 0; i < avail - SPARE; i++){
+      if((p = sbrk(PGSIZE)) == (char*)-1)
+        break;
+      *p = 1;
+    }
+    write(ready[1], "x", 1);
+    for(;;) sleep(1000);
+  }
+  close(ready[1]);
+  if(read(ready[0], &c, 1) != 1){
+    printf("%s: hog failed\n", s);
+    exit(1);
+  }
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    for(j = 0; j < sizeof(buf); j++)
+      buf[j] = i + j;
+    p = a + i*PGSIZE + 1000;
+    if(write(fds[1], buf, sizeof(buf)) != sizeof(buf) ||
+       read(fds[0], p, sizeof(buf)) != sizeof(buf) ||
+       memcmp(p, buf, sizeof(buf)) != 0){
+      printf("%s: read into page %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  kill(hog);
+  wait(0);
+  close(ready[0]);
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-N*PGSIZE);
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2850,11 +3333,18 @@ main(int argc, char *argv[])
     {sharedfd, "sharedfd"},
     {dirtest, "dirtest"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
+    {threadtest, "threadtest"},
+    {futextest, "futextest"},
+    {fsynctest, "fsynctest"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
+    {megapages, "megapages"},
+    {zeropage, "zeropage"},
+    {pipezero, "pipezero"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
@@ -2871,6 +3361,7 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {shmtest, "shmtest"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
@@ -6,24 +6,27 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry(name) defines name(); entry(name, sym) defines sym()
+# instead, for a system call that ulib.c wraps.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $sym = shift || $name;
+    print ".global $sym\n";
+    print "${sym}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
-entry("close");
+entry("close", "_close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -39,3 +42,12 @@ entry("uptime");
 entry("pause_system");
 entry("kill_system");
 entry("print_stats");
+entry("shmget");
+entry("shmat");
+entry("shmdt");
+entry("spawn", "_spawn");
+entry("clone");
+entry("join");
+entry("futexwait");
+entry("futexwake");
+entry("fsync");